@@ -28,6 +28,7 @@
 
 #include "Arduboy.h"
 #include "audio.h"
+#include "scheduler.h"
 #include "glcdfont.c"
 
 /**
@@ -36,11 +37,42 @@
 #define GAME_TITLE        F("ARDUSKETCH")
 #define GAME_VERSION      F("0.1.1")
 
+/**
+ * Task Rates
+ */
+#define INPUT_PERIOD      (2 * TUNES_TICK_US)  // us between input checks, 488 Hz at 16MHz
+#define FRAME_RATE        60          // frames per second of the render task
+#define AUTOSAVE_PERIOD   10000000UL  // us between autosaves, 0.1 Hz
+#define AUTOSAVE_RETRY    4000UL      // us until the next byte, past one EEPROM write
+#define TELEMETRY_PERIOD  1000000UL   // us between telemetry frames, 1 Hz
+
+/**
+ * Serial Commands
+ */
+#define RAM_COMMAND       'm'   // asks for ram_report()
+
 /**
  * Delay Values 
  */
-#define FRAME_DELAY       20
-#define SCROLL_DELAY      5
+#define IMPORT_FRAME_TIME 15    // ms per frame spent draining serial input
+#define IMPORT_TIMEOUT    1000  // ms of silence that ends a started import
+#define SLEEP_TIMEOUT     120000UL  // ms without input before sleeping, 0 never
+
+/**
+ * Autosave Layout, a magic byte and size_option then the canvas
+ */
+#define AUTOSAVE_MAGIC    0xA5
+#define AUTOSAVE_ADDR     EEPROM_STORAGE_SPACE_START
+#define AUTOSAVE_HEADER   2
+#define AUTOSAVE_IDLE     0xFFFF
+
+/**
+ * Animation and Clipboard Limits
+ */
+#define ARENA_SIZE        384   // bytes shared by the frames and the clipboard
+#define ANIM_MAX_FRAMES   8
+#define ANIM_MIN_RATE     4
+#define ANIM_MAX_RATE     30    // at most FRAME_RATE
 
 /**
  * Defined Screen Modes
@@ -51,21 +83,51 @@
 #define MODE_SIZE_SELECT  4
 #define MODE_DRAW         5
 #define MODE_MENU         6
+#define MODE_IMPORT       7
+#define MODE_PLAY         8
+#define MODE_SHIFT        9
+#define MODE_SELECT       10
+#define MODE_PASTE        11
+
+/**
+ * Menu Items
+ */
+#define MENU_BACK         0
+#define MENU_CLEAR        1
+#define MENU_ZOOM         2
+#define MENU_CODE         3
+#define MENU_SVG          4
+#define MENU_IMPORT       5
+#define MENU_FRAME        6
+#define MENU_ONION        7
+#define MENU_PLAY         8
+#define MENU_FLIP_H       9
+#define MENU_FLIP_V       10
+#define MENU_ROTATE       11
+#define MENU_INVERT       12
+#define MENU_SHIFT        13
+#define MENU_SELECT       14
+#define MENU_PASTE        15
+#define MENU_RAM          16
+#define MENU_MAIN         17
+#define MENU_ITEMS        18
+#define MENU_ROWS         6     // item rows visible below the title
 
 /**
  * Arduboy Interfaces
  */ 
 Arduboy display;
 ArduboyTunes audio;   
+ArduboyScheduler scheduler;
 
 /**
  * System State Variables
  */
-unsigned short input        = 0;
-unsigned short next_mode    = 0;
+unsigned short next_mode    = MODE_SPLASH;
 unsigned short current_mode = 0;
-unsigned short delay_scroll = 0;
 unsigned short size_option  = 0;
+unsigned char  redraw       = 1;   // the current screen must run again
+unsigned long  last_input   = 0;   // millis() of the last button activity
 
 /**
  * Cursor and Image Information
@@ -81,20 +143,82 @@ unsigned short zoom_option  = 1;
 unsigned short image_size_x = 128;
 unsigned short image_size_y = 64;
 
-// Menu Buffer used to write directly to display this prevents screen buffer from being deleted.
-unsigned char menu[] = {
-  ' ', ' ', 'M', 'E' ,'N' ,'U', ' ', ' ', ' ', ' ', 
-  ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
-  'B', 'A', 'C', 'K', ' ', ' ', ' ', ' ', ' ', ' ',
-  'C', 'L', 'E', 'A' ,'R', ' ', ' ', ' ', ' ', ' ',
-  'Z', 'O', 'O', 'M' ,':', '?', 'X', ' ', ' ', ' ',
-  'P', 'R', 'I', 'N', 'T', ' ', 'C', 'O' ,'D', 'E', 
-  'P', 'R', 'I', 'N', 'T', ' ', 'S', 'V', 'G', ' ',
-  'M', 'A', 'I', 'N', ' ', 'M', 'E', 'N', 'U', ' '
+// Menu Text, written directly to the display so the screen buffer is not deleted.
+const static char menu_items[MENU_ITEMS][11] PROGMEM = {
+  "BACK      ",
+  "CLEAR     ",
+  "ZOOM:?X   ",
+  "PRINT CODE",
+  "PRINT SVG ",
+  "IMPORT    ",
+  "FRAME ?/? ",
+  "ONION:    ",
+  "PLAY ??FPS",
+  "FLIP H    ",
+  "FLIP V    ",
+  "ROTATE 90 ",
+  "INVERT    ",
+  "SHIFT     ",
+  "SELECT    ",
+  "PASTE     ",
+  "RAM:      ",
+  "MAIN MENU "
 };
 
-// Line Index of Arrow on Menu
-unsigned char menu_option = 2;
+// Selected Menu Item and First Item Shown on Screen
+unsigned char menu_option = 0;
+unsigned char menu_top    = 0;
+
+/**
+ * Serial Import State
+ */
+unsigned char import_status    = IMPORT_BUSY;
+unsigned char import_receiving = 0;
+unsigned long import_last_byte = 0;
+
+/**
+ * Arena
+ *
+ * Animation frames fill it from the front and the clipboard sits at the
+ * back, so a canvas too big to animate has it all for the clipboard.
+ * A frame that would run into the clipboard empties the clipboard.
+ */
+unsigned char arena[ARENA_SIZE];
+
+/**
+ * Animation State
+ *
+ * Frames of the 8x8, 16x16 and 32x32 canvases are kept bit packed in
+ * the arena in drawBitmap() layout, one after the other, so the arena
+ * is also the exported sprite sheet.  The frame being edited lives in
+ * the screen buffer and is written back when leaving it.
+ */
+unsigned char anim_frames     = 1;
+unsigned char anim_frame      = 0;
+unsigned char anim_max_frames = 1;
+unsigned char anim_onion      = 1;
+unsigned char anim_rate       = 8;
+unsigned char play_frame      = 0;
+unsigned char play_phase      = 0;   // anim_rate added every frame
+
+/**
+ * Clipboard
+ *
+ * A copied rectangle, bit packed in drawBitmap() layout at the end of
+ * the arena, see clip_data().
+ */
+unsigned char clip_width  = 0;
+unsigned char clip_height = 0;
+unsigned char select_x    = 0;
+unsigned char select_y    = 0;
+unsigned char select_set  = 0;
+
+/**
+ * Autosave State
+ */
+unsigned char  autosave_task    = 0;
+unsigned short autosave_pos     = AUTOSAVE_IDLE;  // next byte of a save
+unsigned char  autosave_restore = 1;              // until a canvas is opened
 
 /**********************************
  * COMPILED ASSETS                *
@@ -113,6 +237,50 @@ const unsigned char PROGMEM startup[] = {
 };
 
 
+/*********************
+ * Prototypes        *
+ *********************/
+
+// The Arduino IDE writes these itself, other compilers need them (host/)
+void intro();
+void task_input();
+void task_telemetry();
+void ram_report();
+void task_render();
+void invalidate();
+void screen_splash();
+void screen_instructions();
+void screen_credits();
+void screen_size_select();
+void screen_draw();
+void cursor_input();
+void screen_select();
+void screen_paste();
+unsigned char *clip_data();
+unsigned short clip_bytes();
+unsigned char paste_width();
+unsigned char paste_height();
+void draw_canvas();
+void screen_menu();
+bool menu_shown(unsigned char item);
+unsigned char menu_item(unsigned char pos);
+unsigned char menu_length();
+void menu_text(unsigned short i, char *line);
+void screen_import();
+void screen_play();
+void screen_shift();
+void task_autosave();
+unsigned char autosave_byte(unsigned short pos);
+unsigned short frame_bytes();
+unsigned short anim_bytes();
+void frame_store(unsigned char frame);
+void frame_load(unsigned char frame);
+void frame_select(unsigned char frame);
+void frame_next();
+void update_onion();
+void prep_display();
+
+
 /*********************
  * Functions         *
  *********************/
@@ -120,12 +288,18 @@ const unsigned char PROGMEM startup[] = {
 /**
  * Function: setup()
  * 
- * This function initializes arduboy and plays intro
+ * This function initializes arduboy, plays intro and starts the tasks
  */
 void setup()
 {
   display.start();
   intro();
+  scheduler.add(task_input, INPUT_PERIOD);
+  scheduler.add(task_render, 1000000UL / FRAME_RATE);
+  autosave_task = scheduler.add(task_autosave, AUTOSAVE_PERIOD);
+#ifdef PROFILING
+  scheduler.add(task_telemetry, TELEMETRY_PERIOD);
+#endif
 }
 
 /**
@@ -145,7 +319,6 @@ void intro()
     display.display();
     audio.delay(10);
   }
-  display.setFrameRate(0);
 
   audio.playScore(startup);
   audio.delay(2000);
@@ -154,17 +327,110 @@ void intro()
 /**
  * Function : loop
  * 
- * This routine is the main program loop.
- * 
- *     1. Read Input
- *     2. Handle Current Mode
- *     3. Display if Necessary
- *     4. Repeat After Delay
+ * This routine is the main program loop.  It hands the CPU to the
+ * scheduler, which runs each task when it is due and sleeps between.
  */
 void loop() 
 {
-  input = display.getInput();
-  
+  scheduler.runNext();
+}
+
+/**
+ * Function : task_input()
+ *
+ * Runs at 500 Hz.  A RAM_COMMAND byte on serial, outside of an
+ * import, asks for ram_report().  Any button held or changed
+ * invalidates the screen, and after SLEEP_TIMEOUT without either the
+ * display is turned off until up, left or down is pressed, then the
+ * current screen is drawn again.
+ */
+void task_input()
+{
+  if (current_mode != MODE_IMPORT && Serial.available())
+  {
+    if (Serial.read() == RAM_COMMAND) { ram_report(); }
+  }
+  if (display.buttonState() || display.buttonsWaiting())
+  {
+    invalidate();
+    last_input = millis();
+  }
+  else if (SLEEP_TIMEOUT && millis() - last_input > SLEEP_TIMEOUT &&
+           current_mode != MODE_IMPORT && current_mode != MODE_PLAY)
+  {
+    display.powerDown();
+    scheduler.wake();
+    last_input = millis();
+    invalidate();
+  }
+}
+
+#ifdef PROFILING
+/**
+ * Function : task_telemetry()
+ *
+ * Sends the PROFILE() counters, the display bus counters, the RAM
+ * figures, the wake latency and the scheduler's task counters over
+ * Serial once a second, for tools/ardusketch-telemetry.
+ */
+void task_telemetry()
+{
+  profileSend(Serial);
+  display.busSend(Serial);
+  display.ramSend(Serial);
+  display.wakeSend(Serial);
+  scheduler.statsSend(Serial);
+}
+#endif
+
+/**
+ * Function : ram_report()
+ *
+ * Prints the free RAM now, the least there has been and the deepest
+ * the stack has reached since power up, see Arduboy::paintStack().
+ */
+void ram_report()
+{
+  Serial.print(F("ram free "));
+  Serial.print(display.freeRam());
+  Serial.print(F(" min "));
+  Serial.print(display.freeRamMin());
+  Serial.print(F(" stack "));
+  Serial.println(display.stackHighWater());
+}
+
+/**
+ * Function : task_render()
+ *
+ * Runs at FRAME_RATE.
+ * 
+ *     1. Skip the Frame if Nothing Needs Redrawing
+ *     2. Take a Snapshot of the Buttons
+ *     3. Handle Current Mode
+ *     4. Display if Necessary
+ *
+ * A screen only runs, and sends the screen, when it has been
+ * invalidated, so an idle editor leaves the display alone.
+ */
+void task_render()
+{
+  if (!redraw)
+  {
+    return;
+  }
+  redraw = 0;
+  unsigned long start = micros();
+
+  // Settle the mode before the buttons are read, so every press is seen
+  // by the screen that runs this frame rather than used up by none
+  if (next_mode < MODE_SPLASH || next_mode > MODE_PASTE)
+  {
+    next_mode = MODE_SPLASH;
+  }
+  display.pollButtons();
+  PROFILE(PROFILE_LOGIC);
+
+  unsigned short last_mode = current_mode;
   switch (next_mode) 
   {
      case MODE_SPLASH:
@@ -185,15 +451,49 @@ void loop()
      case MODE_MENU:
        screen_menu();
        break;
-     default:
-       next_mode = MODE_SPLASH;
+     case MODE_IMPORT:
+       screen_import();
+       break;
+     case MODE_PLAY:
+       screen_play();
+       break;
+     case MODE_SHIFT:
+       screen_shift();
+       break;
+     case MODE_SELECT:
+       screen_select();
+       break;
+     case MODE_PASTE:
+       screen_paste();
+       break;
+  }
+  if (next_mode != current_mode || current_mode != last_mode)
+  {
+    invalidate();
   }
   
   if (current_mode != MODE_DRAW &&
-      current_mode != MODE_MENU) {
+      current_mode != MODE_MENU &&
+      current_mode != MODE_IMPORT &&
+      current_mode != MODE_PLAY &&
+      current_mode != MODE_SHIFT &&
+      current_mode != MODE_SELECT &&
+      current_mode != MODE_PASTE) {
     display.display();
   }
-  audio.delay(FRAME_DELAY);
+  display.frameDone(micros() - start);
+}
+
+/**
+ * Function : invalidate()
+ *
+ * Runs the current screen again on the next frame.  Input and mode
+ * changes do this in loop(), screens that change by themselves call it
+ * every frame they need.
+ */
+void invalidate()
+{
+  redraw = 1;
 }
 
 /**
@@ -209,17 +509,11 @@ void screen_splash()
   if (next_mode != current_mode)
   {
     current_mode = MODE_SPLASH;
-    delay_scroll = SCROLL_DELAY;
   }
   
-  if (delay_scroll)
-  {
-    delay_scroll--;
-  } else {
-    if (input & LEFT_BUTTON)  { next_mode = MODE_CREDITS; }
-    if (input & RIGHT_BUTTON) { next_mode = MODE_INSTRUCTIONS; }
-    if (input & A_BUTTON)     { next_mode = MODE_SIZE_SELECT; }
-  }   
+  if (display.justPressed(LEFT_BUTTON))  { next_mode = MODE_CREDITS; }
+  if (display.justPressed(RIGHT_BUTTON)) { next_mode = MODE_INSTRUCTIONS; }
+  if (display.justPressed(A_BUTTON))     { next_mode = MODE_SIZE_SELECT; }
 
   display.clearDisplay();
   display.setCursor(8,8);
@@ -241,17 +535,11 @@ void screen_instructions()
   if (next_mode != current_mode)
   {
     current_mode = MODE_INSTRUCTIONS;
-    delay_scroll = SCROLL_DELAY;
   }
   
-  if (delay_scroll)
-  {
-    delay_scroll--;
-  } else {
-    if (input & LEFT_BUTTON)  { next_mode = MODE_SPLASH; }
-    if (input & RIGHT_BUTTON) { next_mode = MODE_CREDITS; }
-    if (input & A_BUTTON)     { next_mode = MODE_SIZE_SELECT; }
-  }   
+  if (display.justPressed(LEFT_BUTTON))  { next_mode = MODE_SPLASH; }
+  if (display.justPressed(RIGHT_BUTTON)) { next_mode = MODE_CREDITS; }
+  if (display.justPressed(A_BUTTON))     { next_mode = MODE_SIZE_SELECT; }
 
   display.clearDisplay();
   display.setCursor(34,0);
@@ -274,17 +562,11 @@ void screen_credits()
   if (next_mode != current_mode)
   {
     current_mode = MODE_CREDITS;
-    delay_scroll = SCROLL_DELAY;
   }
   
-  if (delay_scroll)
-  {
-    delay_scroll--;
-  } else {
-    if (input & LEFT_BUTTON)  { next_mode = MODE_INSTRUCTIONS; }
-    if (input & RIGHT_BUTTON) { next_mode = MODE_SPLASH; }
-    if (input & A_BUTTON)     { next_mode = MODE_SIZE_SELECT; }
-  }   
+  if (display.justPressed(LEFT_BUTTON))  { next_mode = MODE_INSTRUCTIONS; }
+  if (display.justPressed(RIGHT_BUTTON)) { next_mode = MODE_SPLASH; }
+  if (display.justPressed(A_BUTTON))     { next_mode = MODE_SIZE_SELECT; }
 
   display.clearDisplay();
   display.setCursor(43,0);
@@ -309,19 +591,16 @@ void screen_size_select()
   if (next_mode != current_mode)
   {
     current_mode = MODE_SIZE_SELECT;
-    delay_scroll = SCROLL_DELAY;
     size_option = 0;
+    if (autosave_restore && EEPROM.read(AUTOSAVE_ADDR) == AUTOSAVE_MAGIC)
+    {
+      size_option = min(EEPROM.read(AUTOSAVE_ADDR + 1), 4);
+    }
   }
   
-  if (delay_scroll)
-  {
-    delay_scroll--;
-  } else {
-    
-    if (input & UP_BUTTON)    { delay_scroll = SCROLL_DELAY;   if (size_option) {size_option--;}}
-    if (input & DOWN_BUTTON)  { delay_scroll = SCROLL_DELAY; size_option++;  if (size_option >4) {size_option=4;}}
-    if (input & A_BUTTON)     { next_mode = MODE_DRAW; }
-  }   
+  if (display.repeatCount(UP_BUTTON))   { if (size_option) {size_option--;}}
+  if (display.repeatCount(DOWN_BUTTON)) { if (size_option < 4) {size_option++;}}
+  if (display.justPressed(A_BUTTON))     { next_mode = MODE_DRAW; }
 
   display.clearDisplay();
   display.setCursor(34,0);
@@ -366,28 +645,141 @@ void screen_draw(){
   {
     
     current_mode = MODE_DRAW;
-    delay_scroll = SCROLL_DELAY;
     prep_display();
     display.prepZoomSwitch(zoom_option); 
   }
 
-  if (delay_scroll)
+  cursor_input();
+  if (display.justPressed(A_BUTTON))     { display.flipPixel(cursor_x, cursor_y); }
+  if (display.justPressed(B_BUTTON))     { next_mode = MODE_MENU; }
+
+  draw_canvas();
+}
+
+/**
+ * Function : cursor_input()
+ *
+ * Moves the cursor inside the canvas with the d-pad, a pixel per press
+ * and then faster the longer a direction is held, see repeatCount().
+ */
+void cursor_input()
+{
+  unsigned char n;
+  for (n = display.repeatCount(UP_BUTTON);    n && cursor_y > cursor_y_min; n--) { cursor_y--; }
+  for (n = display.repeatCount(DOWN_BUTTON);  n && cursor_y < cursor_y_max; n--) { cursor_y++; }
+  for (n = display.repeatCount(LEFT_BUTTON);  n && cursor_x > cursor_x_min; n--) { cursor_x--; }
+  for (n = display.repeatCount(RIGHT_BUTTON); n && cursor_x < cursor_x_max; n--) { cursor_x++; }
+}
+
+/**
+ * Function : screen_select()
+ *
+ * Rectangle select.  A marks the first corner, A again at the opposite
+ * corner copies the rectangle to the clipboard and returns to drawing.
+ * The selection is cut down to the rows that fit in the arena beside
+ * the animation frames.  B cancels.
+ */
+void screen_select()
+{
+  if (next_mode != current_mode)
   {
-    delay_scroll--;
-  } else {
-    if (input & UP_BUTTON)    { if (cursor_y > cursor_y_min) { cursor_y--;} delay_scroll = 5;}
-    if (input & DOWN_BUTTON)  { if (cursor_y < cursor_y_max) { cursor_y++;} delay_scroll = 5;}
-    if (input & LEFT_BUTTON)  { if (cursor_x > cursor_x_min) { cursor_x--;} delay_scroll = 5;}
-    if (input & RIGHT_BUTTON) { if (cursor_x < cursor_x_max) { cursor_x++;} delay_scroll = 5;}
-    if (input & A_BUTTON)     { display.flipPixel(cursor_x, cursor_y); delay_scroll = 5; }
-    if (input & B_BUTTON)     { next_mode = MODE_MENU; }
-  }  
+    current_mode = MODE_SELECT;
+    select_set = 0;
+  }
+
+  cursor_input();
+  if (display.justPressed(A_BUTTON))
+  {
+    if (!select_set)
+    {
+      select_x = cursor_x;
+      select_y = cursor_y;
+      select_set = 1;
+    } else {
+      unsigned char x = min(select_x, cursor_x);
+      unsigned char y = min(select_y, cursor_y);
+      clip_width  = max(select_x, cursor_x) - x + 1;
+      clip_height = max(select_y, cursor_y) - y + 1;
+      clip_height = min(clip_height, ((ARENA_SIZE - anim_bytes()) / clip_width) * 8);
+      if (!clip_height) { clip_width = 0; }
+      display.copyRegion(x, y, clip_width, clip_height, clip_data());
+      next_mode = MODE_DRAW;
+      current_mode = MODE_DRAW;
+    }
+  }
+  if (display.justPressed(B_BUTTON))     { next_mode = MODE_DRAW; current_mode = MODE_DRAW; }
+
+  draw_canvas();
+}
+
+/**
+ * Function : screen_paste()
+ *
+ * The clipboard follows the cursor as an overlay, cut to the canvas,
+ * so the canvas is only changed when A confirms the paste.  B cancels.
+ */
+void screen_paste()
+{
+  if (next_mode != current_mode)
+  {
+    current_mode = MODE_PASTE;
+  }
+
+  cursor_input();
+  if (display.justPressed(A_BUTTON))
+  {
+    display.pasteRegion(clip_data(), clip_width, cursor_x, cursor_y, paste_width(), paste_height());
+  }
+  if (display.justPressed(A_BUTTON) || display.justPressed(B_BUTTON))
+  {
+    next_mode = MODE_DRAW;
+    current_mode = MODE_DRAW;
+    update_onion();
+    draw_canvas();
+    return;
+  }
+
+  display.setOverlay(clip_data(), cursor_x, cursor_y, paste_width(), paste_height(),
+                     OVERLAY_PASTE, clip_width);
+  draw_canvas();
+}
+
+unsigned char *clip_data()
+{
+  return arena + ARENA_SIZE - clip_bytes();
+}
+
+unsigned short clip_bytes()
+{
+  return clip_width * ((clip_height + 7) / 8);
+}
+
+unsigned char paste_width()
+{
+  return min(clip_width, cursor_x_max - cursor_x + 1);
+}
+
+unsigned char paste_height()
+{
+  return min(clip_height, cursor_y_max - cursor_y + 1);
+}
+
+/**
+ * Function : draw_canvas()
+ *
+ * Sends the canvas to the screen at the current zoom with the cursor.
+ */
+void draw_canvas()
+{
+  bool cursor = current_mode != MODE_PLAY &&
+                current_mode != MODE_SHIFT &&
+                current_mode != MODE_PASTE;
 
   switch (zoom_option)
   {
-    case 1 : display.drawScreen1X(cursor_x, cursor_y); break;
-    case 2 : display.drawScreen2X(cursor_x, cursor_y); break;
-    case 4 : display.drawScreen4X(cursor_x, cursor_y); break;
+    case 1 : display.drawScreen1X(cursor_x, cursor_y, cursor); break;
+    case 2 : display.drawScreen2X(cursor_x, cursor_y, cursor); break;
+    case 4 : display.drawScreen4X(cursor_x, cursor_y, cursor); break;
   }  
 }
 
@@ -395,94 +787,490 @@ void screen_menu()
 {
   if (next_mode != current_mode)
   { 
+    // coming back from an import keeps the arrow on its status
+    if (current_mode != MODE_IMPORT)
+    {
+      menu_option = MENU_BACK;
+      menu_top    = 0;
+    }
     current_mode = MODE_MENU;
-    delay_scroll = SCROLL_DELAY;
-    menu_option  = 2;
   }
 
-  if (delay_scroll)
+  unsigned char n;
+  unsigned char length = menu_length();
+  for (n = display.repeatCount(UP_BUTTON); n && menu_option > 0; n--) { menu_option--; }
+  for (n = display.repeatCount(DOWN_BUTTON); n && menu_option < length - 1; n--) { menu_option++; }
+  if (menu_option < menu_top) { menu_top = menu_option; }
+  if (menu_option >= menu_top + MENU_ROWS) { menu_top = menu_option - MENU_ROWS + 1; }
+  unsigned char item = menu_item(menu_option);
+  if (item == MENU_FRAME)
   {
-    delay_scroll--;
-  } else {
-    if (input & UP_BUTTON)    { if(menu_option > 2) { menu_option--; } delay_scroll = SCROLL_DELAY;}
-    if (input & DOWN_BUTTON)  { if(menu_option < 7) { menu_option++; } delay_scroll = SCROLL_DELAY;}
-    if (input & A_BUTTON)     { 
-       switch (menu_option) {
-         case 2: 
-           next_mode = MODE_DRAW;
-           current_mode = MODE_DRAW;
-           delay_scroll = SCROLL_DELAY;
-           break;
-         case 3:
-           next_mode = MODE_DRAW;
-           break;
-         case 4:
-           zoom_option = zoom_option << 1;
-           if (zoom_option > 4)  { zoom_option = 1; }
-           display.prepZoomSwitch(zoom_option); 
-           delay_scroll = SCROLL_DELAY;
-           break;
-         case 5:
+    if (display.justPressed(LEFT_BUTTON))  { frame_select(anim_frame ? anim_frame - 1 : anim_frames - 1); }
+    if (display.justPressed(RIGHT_BUTTON)) { frame_next(); }
+  }
+  if (item == MENU_PLAY)
+  {
+    for (n = display.repeatCount(LEFT_BUTTON);  n && anim_rate > ANIM_MIN_RATE; n--) { anim_rate--; }
+    for (n = display.repeatCount(RIGHT_BUTTON); n && anim_rate < ANIM_MAX_RATE; n--) { anim_rate++; }
+  }
+  if (display.justPressed(A_BUTTON))     { 
+     switch (item) {
+       case MENU_BACK: 
+         next_mode = MODE_DRAW;
+         current_mode = MODE_DRAW;
+         break;
+       case MENU_CLEAR:
+         next_mode = MODE_DRAW;
+         break;
+       case MENU_ZOOM:
+         zoom_option = zoom_option << 1;
+         if (zoom_option > 4)  { zoom_option = 1; }
+         display.prepZoomSwitch(zoom_option); 
+         break;
+       case MENU_CODE:
+         if (anim_frames > 1)
+         {
+           frame_store(anim_frame);
+           display.writeCode(arena, image_size_x, image_size_y, anim_frames);
+         } else {
            display.writeCode(image_size_x, image_size_y);
-           // Print Code;
-           break;
-         case 6:
-           display.writeSVG(image_size_x, image_size_y);
-           break;
-         case 7:
-           next_mode = MODE_SPLASH;
-           break;
-       }
-    }
-    if (input & B_BUTTON)     { next_mode = MODE_DRAW; current_mode = MODE_DRAW; delay_scroll = SCROLL_DELAY;}
-  } 
+         }
+         // Print Code;
+         break;
+       case MENU_SVG:
+         display.writeSVG(image_size_x, image_size_y);
+         break;
+       case MENU_IMPORT:
+         next_mode = MODE_IMPORT;
+         break;
+       case MENU_FRAME:
+         frame_next();
+         break;
+       case MENU_ONION:
+         anim_onion = !anim_onion;
+         update_onion();
+         break;
+       case MENU_PLAY:
+         if (anim_frames > 1) { next_mode = MODE_PLAY; }
+         break;
+       case MENU_FLIP_H:
+         display.flipHorizontal(cursor_x_min, cursor_y_min, image_size_x, image_size_y);
+         break;
+       case MENU_FLIP_V:
+         display.flipVertical(cursor_x_min, cursor_y_min, image_size_x, image_size_y);
+         break;
+       case MENU_ROTATE:
+         display.rotate90(cursor_x_min, cursor_y_min, image_size_x, image_size_y);
+         break;
+       case MENU_INVERT:
+         display.invertRegion(cursor_x_min, cursor_y_min, image_size_x, image_size_y);
+         break;
+       case MENU_SHIFT:
+         next_mode = MODE_SHIFT;
+         break;
+       case MENU_SELECT:
+         next_mode = MODE_SELECT;
+         break;
+       case MENU_PASTE:
+         if (clip_width) { next_mode = MODE_PASTE; }
+         break;
+       case MENU_RAM:
+         ram_report();
+         break;
+       case MENU_MAIN:
+         next_mode = MODE_SPLASH;
+         break;
+     }
+  }
+  if (display.justPressed(B_BUTTON))     { next_mode = MODE_DRAW; current_mode = MODE_DRAW; }
 
-  switch (zoom_option) {
-    case 1: menu[45] = '1'; break;
-    case 2: menu[45] = '2'; break;
-    case 4: menu[45] = '4'; break;
-    default: zoom_option = 1; menu[45] = '1'; break;
+  if (zoom_option != 1 && zoom_option != 2 && zoom_option != 4) {
+    zoom_option = 1;
   }
   
+  PROFILE(PROFILE_PUSH);
+  display.pushBegin();
   unsigned short i = 0;
   unsigned short j = 0;
+  char line[10];
   for (i = 0; i < 8; i++)
   {
+    menu_text(i, line);
     for(j = 0; j < 4; j++)
     {
-      SPI.transfer(0x00);
+      display.transfer(0x00);
     }
     for(j = 0; j < 8; j++)
     {
-      if (i == menu_option)
+      if (i == menu_option - menu_top + 2)
       {
-        SPI.transfer(pgm_read_byte(arrow+j));
+        display.transfer(pgm_read_byte(arrow+j));
       } else {
-        SPI.transfer(0x00);
+        display.transfer(0x00);
       }
     }
     for(j = 0; j < 4; j++)
     {
-      SPI.transfer(0x00);
+      display.transfer(0x00);
     }
     for(j = 0; j < 10; j++)
     {
-      unsigned long ref = menu[i*10 + j];
+      unsigned long ref = (unsigned char)line[j];
       ref = ref * 5;
    //   ref = font + ref;
       
-      SPI.transfer(pgm_read_byte(font+ref));
-      SPI.transfer(pgm_read_byte(font+ref+1));
-      SPI.transfer(pgm_read_byte(font+ref+2));
-      SPI.transfer(pgm_read_byte(font+ref+3));
-      SPI.transfer(pgm_read_byte(font+ref+4));
-      SPI.transfer(0x00);
+      display.transfer(pgm_read_byte(font+ref));
+      display.transfer(pgm_read_byte(font+ref+1));
+      display.transfer(pgm_read_byte(font+ref+2));
+      display.transfer(pgm_read_byte(font+ref+3));
+      display.transfer(pgm_read_byte(font+ref+4));
+      display.transfer(0x00);
     }
     for(j = 0; j < 52; j++)
     {
-      SPI.transfer(0x00);
+      display.transfer(0x00);
     }    
   }
+  display.pushEnd();
+}
+
+/**
+ * Function : menu_shown()
+ *
+ * Items that would do nothing on the current canvas are left out of
+ * the menu: the animation items where only one frame fits, and ROTATE
+ * on the 128x64 canvas, which is not square.
+ */
+bool menu_shown(unsigned char item)
+{
+  switch (item)
+  {
+    case MENU_FRAME:
+    case MENU_ONION:
+    case MENU_PLAY:
+      return anim_max_frames > 1;
+    case MENU_ROTATE:
+      return image_size_x == image_size_y;
+  }
+  return true;
+}
+
+/**
+ * Function : menu_item()
+ *
+ * The item at a position in the menu, counting only the items shown,
+ * or MENU_ITEMS past the last one.  menu_option and menu_top are
+ * positions.
+ */
+unsigned char menu_item(unsigned char pos)
+{
+  for (unsigned char item = 0; item < MENU_ITEMS; item++)
+  {
+    if (menu_shown(item) && pos-- == 0) { return item; }
+  }
+  return MENU_ITEMS;
+}
+
+unsigned char menu_length()
+{
+  unsigned char length = 0;
+  for (unsigned char item = 0; item < MENU_ITEMS; item++)
+  {
+    if (menu_shown(item)) { length++; }
+  }
+  return length;
+}
+
+/**
+ * Function : menu_text()
+ *
+ * Fills line with the 10 characters shown on screen row i of the
+ * menu, the title on row 0 and a scrolled window of items below.
+ */
+void menu_text(unsigned short i, char *line)
+{
+  memset(line, ' ', 10);
+  if (i == 0)
+  {
+    memcpy_P(line + 2, PSTR("MENU"), 4);
+    return;
+  }
+  if (i < 2)
+  {
+    return;
+  }
+
+  unsigned char item = menu_item(menu_top + i - 2);
+  if (item >= MENU_ITEMS)
+  {
+    return;
+  }
+  memcpy_P(line, menu_items[item], 10);
+  switch (item)
+  {
+    case MENU_ZOOM:
+      line[5] = '0' + zoom_option;
+      break;
+    case MENU_IMPORT:
+      if (import_status == IMPORT_DONE)  { memcpy(line + 6, ":OK", 3); }
+      if (import_status == IMPORT_ERROR) { memcpy(line + 6, ":ERR", 4); }
+      break;
+    case MENU_FRAME:
+      line[6] = '1' + anim_frame;
+      line[8] = '0' + anim_frames;
+      break;
+    case MENU_ONION:
+      memcpy(line + 6, anim_onion ? "ON" : "OFF", anim_onion ? 2 : 3);
+      break;
+    case MENU_PLAY:
+      line[5] = (anim_rate >= 10) ? '0' + anim_rate / 10 : ' ';
+      line[6] = '0' + anim_rate % 10;
+      break;
+    case MENU_RAM:
+    {
+      char n[6];
+      itoa(display.freeRamMin(), n, 10);
+      memcpy(line + 4, n, strlen(n));
+      break;
+    }
+  }
+}
+
+/**
+ * Function : screen_import()
+ *
+ * Receives an image over serial in the format writeHex() prints and
+ * writes it into the canvas as it arrives.  Most of each frame is spent
+ * draining the USB buffer so a continuous stream is never held up. A
+ * header that does not match the canvas or a bad character aborts the
+ * import, as does a stream that stops part way for IMPORT_TIMEOUT.
+ * B cancels.
+ */
+void screen_import()
+{
+  if (next_mode != current_mode)
+  {
+    current_mode = MODE_IMPORT;
+    import_status = IMPORT_BUSY;
+    import_receiving = 0;
+    while (Serial.available()) { Serial.read(); }
+    display.beginImport(cursor_x_min, cursor_y_min, image_size_x, image_size_y);
+  }
+
+  unsigned long frame_start = millis();
+  do {
+    while (Serial.available() && import_status == IMPORT_BUSY)
+    {
+      import_status = display.importHex(Serial.read());
+      import_receiving = 1;
+      import_last_byte = millis();
+    }
+  } while (import_status == IMPORT_BUSY && millis() - frame_start < IMPORT_FRAME_TIME);
+
+  if (import_status == IMPORT_BUSY && import_receiving &&
+      millis() - import_last_byte > IMPORT_TIMEOUT)
+  {
+    import_status = IMPORT_ERROR;
+  }
+
+  if (display.justPressed(B_BUTTON))     { next_mode = MODE_MENU; }
+  if (import_status != IMPORT_BUSY) { next_mode = MODE_MENU; }
+  invalidate();  // keep draining serial
+
+  draw_canvas();
+}
+
+/**
+ * Function : screen_play()
+ *
+ * Previews the animation at anim_rate frames per second out of the
+ * FRAME_RATE the main loop runs at, spreading the steps evenly the way
+ * a line is drawn.  B stops it.
+ */
+void screen_play()
+{
+  if (next_mode != current_mode)
+  {
+    current_mode = MODE_PLAY;
+    frame_store(anim_frame);
+    display.clearOverlay();
+    play_frame = 0;
+    play_phase = FRAME_RATE;  // show the first frame at once
+  }
+
+  invalidate();
+  play_phase += anim_rate;
+  if (play_phase >= FRAME_RATE)
+  {
+    play_phase -= FRAME_RATE;
+    frame_load(play_frame);
+    play_frame++;
+    if (play_frame >= anim_frames) { play_frame = 0; }
+  }
+
+  if (display.justPressed(B_BUTTON))
+  {
+    frame_load(anim_frame);
+    update_onion();
+    next_mode = MODE_MENU;
+  }
+
+  draw_canvas();
+}
+
+/**
+ * Function : screen_shift()
+ *
+ * Scrolls the canvas a pixel per press, faster when held, with wrap
+ * around, pixels pushed off one edge come back in on the other.  B
+ * returns to the menu.
+ */
+void screen_shift()
+{
+  if (next_mode != current_mode)
+  {
+    current_mode = MODE_SHIFT;
+  }
+
+  int8_t dx = display.repeatCount(RIGHT_BUTTON) - display.repeatCount(LEFT_BUTTON);
+  int8_t dy = display.repeatCount(DOWN_BUTTON) - display.repeatCount(UP_BUTTON);
+  dy = constrain(dy, -7, 7);  // shiftRegion() moves at most 7 rows at once
+  if (dx || dy)
+  {
+    display.shiftRegion(cursor_x_min, cursor_y_min, image_size_x, image_size_y, dx, dy);
+  }
+  if (display.justPressed(B_BUTTON))     { next_mode = MODE_MENU; }
+
+  draw_canvas();
+}
+
+/**
+ * Function : task_autosave()
+ *
+ * Every AUTOSAVE_PERIOD the canvas being edited is copied to EEPROM,
+ * writing only the bytes that changed, and prep_display() draws it back
+ * after the next power up.  An EEPROM write takes 3.4 ms, so rather than
+ * wait for one the task comes back AUTOSAVE_RETRY later for the next
+ * byte; a score played from EEPROM waits for at most that one write.
+ * The 128x64 canvas does not fit and is not saved.
+ */
+void task_autosave()
+{
+  if (current_mode < MODE_DRAW || current_mode == MODE_IMPORT ||
+      current_mode == MODE_PLAY ||
+      AUTOSAVE_ADDR + AUTOSAVE_HEADER + frame_bytes() > E2END + 1)
+  {
+    autosave_pos = AUTOSAVE_IDLE;
+    return;
+  }
+  if (autosave_pos == AUTOSAVE_IDLE) { autosave_pos = 0; }
+
+  while (autosave_pos < AUTOSAVE_HEADER + frame_bytes())
+  {
+    if (!eeprom_is_ready())
+    {
+      scheduler.delayTask(autosave_task, AUTOSAVE_RETRY);
+      return;
+    }
+    EEPROM.update(AUTOSAVE_ADDR + autosave_pos, autosave_byte(autosave_pos));
+    autosave_pos++;
+  }
+  autosave_pos = AUTOSAVE_IDLE;
+}
+
+unsigned char autosave_byte(unsigned short pos)
+{
+  if (pos == 0) { return AUTOSAVE_MAGIC; }
+  if (pos == 1) { return size_option; }
+  pos -= AUTOSAVE_HEADER;
+  return display.getColumnByte(cursor_x_min + pos % image_size_x,
+                               cursor_y_min + (pos / image_size_x) * 8);
+}
+
+/**
+ * Animation Frames
+ *
+ * frame_store() and frame_load() copy the canvas region between the
+ * screen buffer and the frame's slot in the arena, a column byte at a
+ * time so the 8x8 canvas, which is not page aligned, works as well.
+ */
+unsigned short frame_bytes()
+{
+  return image_size_x * (image_size_y / 8);
+}
+
+// arena bytes the frames take, none until there is a second frame
+unsigned short anim_bytes()
+{
+  return anim_frames > 1 ? anim_frames * frame_bytes() : 0;
+}
+
+void frame_store(unsigned char frame)
+{
+  unsigned char *p = arena + frame * frame_bytes();
+  for (unsigned char y = 0; y < image_size_y; y += 8)
+  {
+    for (unsigned char x = 0; x < image_size_x; x++)
+    {
+      *p++ = display.getColumnByte(cursor_x_min + x, cursor_y_min + y);
+    }
+  }
+}
+
+void frame_load(unsigned char frame)
+{
+  const unsigned char *p = arena + frame * frame_bytes();
+  for (unsigned char y = 0; y < image_size_y; y += 8)
+  {
+    for (unsigned char x = 0; x < image_size_x; x++)
+    {
+      display.setColumnByte(cursor_x_min + x, cursor_y_min + y, *p++);
+    }
+  }
+}
+
+void frame_select(unsigned char frame)
+{
+  if (frame == anim_frame) { return; }
+  frame_store(anim_frame);
+  anim_frame = frame;
+  frame_load(anim_frame);
+  update_onion();
+}
+
+// Moves to the next frame, past the last one a new frame is added as a
+// copy of the current one.
+void frame_next()
+{
+  if (anim_frame + 1 < anim_frames)
+  {
+    frame_select(anim_frame + 1);
+  }
+  else if (anim_frames < anim_max_frames)
+  {
+    if ((anim_frames + 1) * frame_bytes() > ARENA_SIZE - clip_bytes())
+    {
+      clip_width = 0;
+      clip_height = 0;
+    }
+    frame_store(anim_frame);
+    anim_frame = anim_frames++;
+    update_onion();
+  }
+}
+
+// The previous frame (wrapping to the last) is composited under the
+// canvas while drawing, it is never copied into the screen buffer.
+void update_onion()
+{
+  if (anim_onion && anim_frames > 1)
+  {
+    unsigned char prev = anim_frame ? anim_frame - 1 : anim_frames - 1;
+    display.setOverlay(arena + prev * frame_bytes(), cursor_x_min, cursor_y_min,
+                       image_size_x, image_size_y, OVERLAY_ONION);
+  } else {
+    display.clearOverlay();
+  }
 }
 
 void prep_display()
@@ -546,6 +1334,25 @@ void prep_display()
       image_size_y = 64;
       break;
   }
+
+  if (autosave_restore && EEPROM.read(AUTOSAVE_ADDR) == AUTOSAVE_MAGIC &&
+      EEPROM.read(AUTOSAVE_ADDR + 1) == size_option)
+  {
+    for (unsigned short i = 0; i < frame_bytes(); i++)
+    {
+      display.setColumnByte(cursor_x_min + i % image_size_x,
+                            cursor_y_min + (i / image_size_x) * 8,
+                            EEPROM.read(AUTOSAVE_ADDR + AUTOSAVE_HEADER + i));
+    }
+  }
+  autosave_restore = 0;
+
+  // animation is offered on the canvases where 2 or more frames fit
+  anim_frames = 1;
+  anim_frame  = 0;
+  anim_max_frames = min(ANIM_MAX_FRAMES, ARENA_SIZE / frame_bytes());
+  if (anim_max_frames < 2) { anim_max_frames = 1; }
+  update_onion();
 }
 
 
@@ -39,6 +39,20 @@ void Arduboy::start()
 
   bootLCD();
 
+  // system tick: Timer0 compare A, half way through each millis() cycle
+  OCR0A = 0x80;
+  TIMSK0 |= _BV(OCIE0A);
+  #ifdef DEVKIT
+  // up, left and down can also interrupt as soon as they change
+  #if defined(TUNES_HW_TOGGLE) || defined(TUNES_SYNTH)
+  PCMSK0 = B01010000;  // left is the OC1A speaker pin
+  #else
+  PCMSK0 = B01110000;
+  #endif
+  PCICR |= _BV(PCIE0);
+  #endif
+  button_state = getInput();
+
   #ifdef SAFE_MODE
   if (pressed(LEFT_BUTTON+UP_BUTTON))
     safeMode();
@@ -46,12 +60,13 @@ void Arduboy::start()
 
   audio.setup();
   saveMuchPower();
+  paintStack();
 }
 
 #if F_CPU == 8000000L
 // if we're compiling for 8Mhz we need to slow the CPU down because the
 // hardware clock on the Arduboy is 16MHz
-void Arduboy::slowCPU()
+inline void Arduboy::slowCPU()
 {
   uint8_t oldSREG = SREG;
   cli();                // suspend interrupts
@@ -61,47 +76,47 @@ void Arduboy::slowCPU()
 }
 #endif
 
-void Arduboy::bootLCD()
+inline void Arduboy::bootLCD()
 {
   LCDCommandMode();
-  SPI.transfer(0xAE);  // Display Off
-  SPI.transfer(0XD5);  // Set Display Clock Divisor v
-  SPI.transfer(0xF0);  //   0x80 is default
-  SPI.transfer(0xA8);  // Set Multiplex Ratio v
-  SPI.transfer(0x3F);
-  SPI.transfer(0xD3);  // Set Display Offset v
-  SPI.transfer(0x0);
-  SPI.transfer(0x40);  // Set Start Line (0)
-  SPI.transfer(0x8D);  // Charge Pump Setting v
-  SPI.transfer(0x14);  //   Enable
+  transfer(0xAE);  // Display Off
+  transfer(0XD5);  // Set Display Clock Divisor v
+  transfer(0xF0);  //   0x80 is default
+  transfer(0xA8);  // Set Multiplex Ratio v
+  transfer(0x3F);
+  transfer(0xD3);  // Set Display Offset v
+  transfer(0x0);
+  transfer(0x40);  // Set Start Line (0)
+  transfer(0x8D);  // Charge Pump Setting v
+  transfer(0x14);  //   Enable
   // why are we running this next pair twice?
-  SPI.transfer(0x20);  // Set Memory Mode v
-  SPI.transfer(0x00);  //   Horizontal Addressing
-  SPI.transfer(0xA1);  // Set Segment Re-map (A0) | (b0001)
-  SPI.transfer(0xC8);  // Set COM Output Scan Direction
-  SPI.transfer(0xDA);  // Set COM Pins v
-  SPI.transfer(0x12);
-  SPI.transfer(0x81);  // Set Contrast v
-  SPI.transfer(0xCF);
-  SPI.transfer(0xD9);  // Set Precharge
-  SPI.transfer(0xF1);
-  SPI.transfer(0xDB);  // Set VCom Detect
-  SPI.transfer(0x40);
-  SPI.transfer(0xA4);  // Entire Display ON
-  SPI.transfer(0xA6);  // Set normal/inverse display
-  SPI.transfer(0xAF);  // Display On
+  transfer(0x20);  // Set Memory Mode v
+  transfer(0x00);  //   Horizontal Addressing
+  transfer(0xA1);  // Set Segment Re-map (A0) | (b0001)
+  transfer(0xC8);  // Set COM Output Scan Direction
+  transfer(0xDA);  // Set COM Pins v
+  transfer(0x12);
+  transfer(0x81);  // Set Contrast v
+  transfer(0xCF);
+  transfer(0xD9);  // Set Precharge
+  transfer(0xF1);
+  transfer(0xDB);  // Set VCom Detect
+  transfer(0x40);
+  transfer(0xA4);  // Entire Display ON
+  transfer(0xA6);  // Set normal/inverse display
+  transfer(0xAF);  // Display On
 
   LCDCommandMode();
-  SPI.transfer(0x20);     // set display mode
-  SPI.transfer(0x00);     // horizontal addressing mode
+  transfer(0x20);     // set display mode
+  transfer(0x00);     // horizontal addressing mode
 
-  SPI.transfer(0x21);     // set col address
-  SPI.transfer(0x00);
-  SPI.transfer(COLUMN_ADDRESS_END);
+  transfer(0x21);     // set col address
+  transfer(0x00);
+  transfer(COLUMN_ADDRESS_END);
 
-  SPI.transfer(0x22); // set page address
-  SPI.transfer(0x00);
-  SPI.transfer(PAGE_ADDRESS_END);
+  transfer(0x22); // set page address
+  transfer(0x00);
+  transfer(PAGE_ADDRESS_END);
 
   LCDDataMode();
 }
@@ -111,7 +126,7 @@ void Arduboy::bootLCD()
 // loop and allows it to be reprogrammed even if you have uploaded a very
 // broken sketch that interferes with the normal USB triggered auto-reboot
 // functionality of the device.
-void Arduboy::safeMode()
+inline void Arduboy::safeMode()
 {
   display(); // too avoid random gibberish
   while (true) {
@@ -121,12 +136,14 @@ void Arduboy::safeMode()
 
 void Arduboy::LCDDataMode()
 {
+  lcd_command = false;
   *dcport |= dcpinmask;
   *csport &= ~cspinmask;
 }
 
 void Arduboy::LCDCommandMode()
 {
+  lcd_command = true;
   *csport |= cspinmask; // why are we doing this twice?
   *csport |= cspinmask;
   *dcport &= ~dcpinmask;
@@ -142,6 +159,51 @@ void Arduboy::idle()
   sleep_mode();
 }
 
+// Turn the screen and sound off and sleep until a button goes down.  Only
+// up, left and down have a pin change interrupt, and left not when it is
+// a speaker pin, so one of those must wake it.  On battery this is power
+// down, which stops millis() and micros() too.  With USB plugged in it is
+// idle instead, to keep the USB connection.  The buffer is untouched, the
+// sketch redraws it afterwards; the time from waking to the end of the
+// next frame is kept in wakeLatencyUs.  The press that wakes it does not
+// count as justPressed().
+void Arduboy::powerDown()
+{
+  LCDCommandMode();
+  transfer(0xAE);  // Display Off
+  LCDDataMode();
+  tunes.closeChannels();
+
+  if (USBSTA & _BV(VBUS))
+    set_sleep_mode(SLEEP_MODE_IDLE);
+  else
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  do {
+    sleep_mode();
+  } while (!(getInput() & (UP_BUTTON | LEFT_BUTTON | DOWN_BUTTON)));
+  wakeStart = micros();
+  waking = true;
+  wakes++;
+  // the frame that called us restarts here, the sleep is not missed frames
+  lastFrameStart = wakeStart;
+  nextFrameStart = wakeStart + eachFrameMicros;
+
+  tunes.initChannel(PIN_SPEAKER_1);
+  tunes.initChannel(PIN_SPEAKER_2);
+  LCDCommandMode();
+  transfer(0xAF);  // Display On
+  LCDDataMode();
+  pollButtons();
+  just_pressed = 0;
+}
+
+// Send the wakes and the last wake latency in a TELEMETRY_WAKE frame
+void Arduboy::wakeSend(Print &out)
+{
+  uint16_t frame[2] = { wakes, wakeLatencyUs };
+  telemetrySend(out, TELEMETRY_WAKE, frame, sizeof(frame));
+}
+
 void Arduboy::saveMuchPower()
 {
   power_adc_disable();
@@ -156,55 +218,215 @@ void Arduboy::saveMuchPower()
 }
 
 
+/* RAM Monitor */
+
+// The free RAM between the heap (or the globals, with no heap) and the
+// stack is filled with STACK_CANARY by start().  Whatever the stack or
+// the heap has used since no longer holds it, so the lowest changed byte
+// is the deepest the stack has been.  A value that happens to equal the
+// canary at the edge makes it read a byte or so shallow.
+extern char __heap_start, *__brkval;
+
+static uint8_t *heapEnd()
+{
+  return (uint8_t *)(__brkval ? __brkval : &__heap_start);
+}
+
+void Arduboy::paintStack()
+{
+  uint8_t *p = heapEnd();
+  // leave what this call itself might push
+  uint8_t *end = (uint8_t *)SP - STACK_PAINT_MARGIN;
+
+  while (p < end)
+    *p++ = STACK_CANARY;
+}
+
+// lowest byte the stack has reached, or the heap end if it met the heap
+static uint8_t *stackLow()
+{
+  uint8_t *p = heapEnd();
+  while (p <= (uint8_t *)SP && *p == STACK_CANARY)
+    p++;
+  return p;
+}
+
+// most bytes of stack used since start()
+uint16_t Arduboy::stackHighWater()
+{
+  return (uint8_t *)RAMEND - stackLow();
+}
+
+// fewest bytes free between the heap and the stack since start()
+uint16_t Arduboy::freeRamMin()
+{
+  return stackLow() - heapEnd();
+}
+
+// bytes free between the heap and the stack now
+uint16_t Arduboy::freeRam()
+{
+  return (uint8_t *)SP - heapEnd();
+}
+
+// Send the RAM figures in a TELEMETRY_RAM frame
+void Arduboy::ramSend(Print &out)
+{
+  uint16_t frame[3] = { freeRam(), freeRamMin(), stackHighWater() };
+  telemetrySend(out, TELEMETRY_RAM, frame, sizeof(frame));
+}
+
+
 /* Frame management */
 
 void Arduboy::setFrameRate(uint8_t rate)
 {
   frameRate = rate;
-  eachFrameMillis = 1000/rate;
+  eachFrameMicros = rate ? 1000000UL / rate : 0;
+  nextFrameStart = micros();
 }
 
+// Frames are due every eachFrameMicros from the first one.  Each deadline
+// is the last one plus a frame, not the time the last frame started, so
+// slow frames do not push the rest back.  When a frame runs so long that
+// whole deadlines have passed, those frames are skipped and counted
+// rather than run back to back to catch up.  A rate of 0 runs a frame on
+// every call.
 bool Arduboy::nextFrame()
 {
-  long now = millis();
-  uint8_t remaining;
+  unsigned long now = micros();
+  long late;
 
   // post render
   if (post_render) {
-    lastFrameDurationMs = now - lastFrameStart;
-    frameCount++;
+    frameDone(now - lastFrameStart);
     post_render = false;
   }
 
+  late = now - nextFrameStart;
   // if it's not time for the next frame yet
-  if (now < nextFrameStart) {
-    remaining = nextFrameStart - now;
-    // if we have more than 1ms to spare, lets sleep
-    // we should be woken up by timer0 every 1ms, so this should be ok
-    if (remaining > 1)
+  if (eachFrameMicros && late < 0) {
+    // sleep if there is more than a system tick to spare, it wakes us
+    if (-late > (long)TUNES_TICK_US)
       idle();
     return false;
   }
 
   // pre-render
-
-  // technically next frame should be last frame + each frame but if we're
-  // running a slow render we would constnatly be behind the clock
-  // keep an eye on this and see how it works.  If it works well the
-  // lastFrameStart variable could be eliminated completely
-  nextFrameStart = now + eachFrameMillis;
+  nextFrameStart += eachFrameMicros;
+  if (eachFrameMicros && late >= (long)eachFrameMicros) {
+    unsigned long missed = late / eachFrameMicros;
+    nextFrameStart += missed * eachFrameMicros;
+    frameSkips += missed;
+  }
   lastFrameStart = now;
   post_render = true;
   return post_render;
 }
 
+// Count a frame that took us to draw.  nextFrame() calls it, a sketch
+// paced some other way calls it after each frame it draws.  Durations go
+// in frame_histogram, FRAME_HISTOGRAM_US wide buckets with the last one
+// taking everything longer.  All buckets are halved when one fills up, so
+// the histogram follows recent frames.
+void Arduboy::frameDone(unsigned long us)
+{
+  unsigned long bucket = us / FRAME_HISTOGRAM_US;
+  if (bucket >= FRAME_HISTOGRAM_BUCKETS)
+    bucket = FRAME_HISTOGRAM_BUCKETS - 1;
+
+  lastFrameDurationUs = min(us, 0xFFFFUL);
+  lastFrameDurationMs = min(us / 1000, 0xFFUL);
+  if (frame_histogram[bucket] == 0xFFFF) {
+    for (uint8_t i = 0; i < FRAME_HISTOGRAM_BUCKETS; i++)
+      frame_histogram[i] >>= 1;
+  }
+  frame_histogram[bucket]++;
+  frameCount++;
+  if (waking) {
+    wakeLatencyUs = min(micros() - wakeStart, 0xFFFFUL);
+    waking = false;
+  }
+}
+
+// frames counted in a bucket, FRAME_HISTOGRAM_US wide, of frame durations
+uint16_t Arduboy::frameHistogram(uint8_t bucket)
+{
+  return bucket < FRAME_HISTOGRAM_BUCKETS ? frame_histogram[bucket] : 0;
+}
+
+void Arduboy::clearFrameStats()
+{
+  memset(frame_histogram, 0, sizeof(frame_histogram));
+  frameSkips = 0;
+}
+
+/* Display Bus */
+
+// Every byte sent to the display goes through transfer(), which counts
+// it as a command or as data when PROFILING is defined, so the counts
+// cost nothing per byte otherwise.  pushBegin() and pushEnd() go round each
+// frame sent, nested calls count once, and the time between goes in a
+// histogram of SPI_PUSH_BUCKETS buckets of SPI_PUSH_US, the last taking
+// every longer push.  Buckets are halved when one fills up.
+void Arduboy::pushBegin()
+{
+  if (!push_depth++)
+    push_start = micros();
+}
+
+void Arduboy::pushEnd()
+{
+  if (--push_depth)
+    return;
+
+  unsigned long bucket = (micros() - push_start) / SPI_PUSH_US;
+  if (bucket >= SPI_PUSH_BUCKETS)
+    bucket = SPI_PUSH_BUCKETS - 1;
+  if (push_histogram[bucket] == 0xFFFF) {
+    for (uint8_t i = 0; i < SPI_PUSH_BUCKETS; i++)
+      push_histogram[i] >>= 1;
+  }
+  push_histogram[bucket]++;
+  spiPushes++;
+}
+
+// pushes counted in a bucket, SPI_PUSH_US wide, of push durations
+uint16_t Arduboy::pushHistogram(uint8_t bucket)
+{
+  return bucket < SPI_PUSH_BUCKETS ? push_histogram[bucket] : 0;
+}
+
+void Arduboy::clearBusStats()
+{
+  memset(push_histogram, 0, sizeof(push_histogram));
+  spiBytes = 0;
+  spiCommands = 0;
+  spiPushes = 0;
+}
+
+// Send the bus counters in a TELEMETRY_BUS frame and start them again
+void Arduboy::busSend(Print &out)
+{
+  uint8_t frame[10 + 2 * SPI_PUSH_BUCKETS];
+
+  memcpy(frame, &spiBytes, 4);
+  memcpy(frame + 4, &spiCommands, 4);
+  memcpy(frame + 8, &spiPushes, 2);
+  memcpy(frame + 10, push_histogram, 2 * SPI_PUSH_BUCKETS);
+  telemetrySend(out, TELEMETRY_BUS, frame, sizeof(frame));
+  clearBusStats();
+}
+
 // returns the load on the CPU as a percentage
 // this is based on how much of the time your app is spends rendering
 // frames.  This number can be higher than 100 if your app is rendering
-// really slowly.
+// really slowly.  An unpaced app is always at 100.
 int Arduboy::cpuLoad()
 {
-  return lastFrameDurationMs*100 / eachFrameMillis;
+  if (!eachFrameMicros)
+    return 100;
+  return (unsigned long)lastFrameDurationUs * 100 / eachFrameMicros;
 }
 
 // seed the random number generator with entropy from the temperature,
@@ -222,10 +444,8 @@ void Arduboy::initRandomSeed()
 uint16_t Arduboy::rawADC(byte adc_bits)
 {
   ADMUX = adc_bits;
-  // we also need MUX5 for temperature check
-  if (adc_bits == ADC_TEMP) {
-    ADCSRB = _BV(MUX5);
-  }
+  // we also need MUX5 for temperature check, and not for anything else
+  ADCSRB = adc_bits == ADC_TEMP ? _BV(MUX5) : 0;
 
   delay(2); // Wait for ADMUX setting to settle
   ADCSRA |= _BV(ADSC); // Start conversion
@@ -239,11 +459,15 @@ uint16_t Arduboy::rawADC(byte adc_bits)
 
 void Arduboy::blank()
 {
-  for (int a = 0; a < (HEIGHT*WIDTH)/8; a++) SPI.transfer(0x00);
+  PROFILE(PROFILE_PUSH);
+  pushBegin();
+  for (int a = 0; a < (HEIGHT*WIDTH)/8; a++) transfer(0x00);
+  pushEnd();
 }
 
 void Arduboy::clearDisplay()
 {
+  PROFILE(PROFILE_DRAW);
   for (int a = 0; a < (HEIGHT*WIDTH)/8; a++) sBuffer[a] = 0x00;
 }
 
@@ -460,6 +684,7 @@ void Arduboy::drawLine
 void Arduboy::drawRect
 (int16_t x, int16_t y, int16_t w, int16_t h, uint8_t color)
 {
+  PROFILE(PROFILE_DRAW);
   drawFastHLine(x, y, w, color);
   drawFastHLine(x, y+h-1, w, color);
   drawFastVLine(x, y, h, color);
@@ -639,6 +864,7 @@ void Arduboy::fillTriangle
 }
 
 void Arduboy::drawBitmap(int16_t x, int16_t y, const uint8_t *bitmap, int16_t w, int16_t h, uint8_t color) {
+  PROFILE(PROFILE_DRAW);
   // no need to dar at all of we're offscreen
   if (x+w < 0 || x > WIDTH-1 || y+h < 0 || y > HEIGHT-1)
     return;
@@ -698,6 +924,7 @@ void Arduboy::drawSlowXYBitmap(int16_t x, int16_t y, const uint8_t *bitmap, int1
 void Arduboy::drawChar
 (int16_t x, int16_t y, unsigned char c, uint8_t color, uint8_t bg, uint8_t size)
 {
+  PROFILE(PROFILE_DRAW);
 
   if ((x >= WIDTH) ||         // Clip right
     (y >= HEIGHT) ||        // Clip bottom
@@ -787,6 +1014,7 @@ size_t Arduboy::write(uint8_t c)
       cursor_x = 0;
     }
   }
+  return 1;
 }
 
 void Arduboy::display()
@@ -796,34 +1024,115 @@ void Arduboy::display()
 
 void Arduboy::drawScreen(const unsigned char *image)
 {
+  PROFILE(PROFILE_PUSH);
+  pushBegin();
   for (int a = 0; a < (HEIGHT*WIDTH)/8; a++)
   {
-    SPI.transfer(pgm_read_byte(image + a));
+    transfer(pgm_read_byte(image + a));
   }
+  pushEnd();
 }
 
 void Arduboy::drawScreen(unsigned char image[])
 {
+  PROFILE(PROFILE_PUSH);
+  pushBegin();
   for (int a = 0; a < (HEIGHT*WIDTH)/8; a++)
   {
-    SPI.transfer(image[a]);
+    transfer(image[a]);
   }
-}
-
-inline unsigned char* Arduboy::getBuffer(){
-  return sBuffer;
+  pushEnd();
 }
 
 uint8_t Arduboy::width() { return WIDTH; }
 
 uint8_t Arduboy::height() { return HEIGHT; }
 
+// Button changes are caught as they happen, by the system tick and by the
+// pin change interrupt, and queued with the time they happened.  The
+// sketch sees them once per frame through pollButtons(), so presses made
+// while a frame is busy are not lost.
+static volatile ButtonEvent input_queue[INPUT_QUEUE_SIZE];
+static volatile uint8_t input_head = 0;     // written by the interrupts only
+static volatile uint8_t input_tail = 0;     // written by pollButtons() only
+static volatile uint8_t input_sampled = 0;  // buttons as last sampled
+
+// Queue the buttons if they have changed.  A full queue drops the change,
+// but pollButtons() still catches up with input_sampled.
+void Arduboy::sampleButtons()
+{
+  uint8_t buttons = getInput();
+  uint8_t head = input_head;
+  volatile ButtonEvent *event;
+
+  if (buttons == input_sampled)
+    return;
+  input_sampled = buttons;
+  if ((uint8_t)(head - input_tail) == INPUT_QUEUE_SIZE)
+    return;
+  event = &input_queue[head & (INPUT_QUEUE_SIZE - 1)];
+  event->buttons = buttons;
+  event->ms = millis();
+  input_head = head + 1;
+}
+
+// Take the snapshot used by pressed(), justPressed() and justReleased()
+// until the next call.  Every change since the last call counts, so a
+// quick tap is seen even if the button is already up again.
+void Arduboy::pollButtons()
+{
+  PROFILE(PROFILE_INPUT);
+  uint8_t last = button_state;
+  uint8_t tail = input_tail;
+  uint8_t now, down;
+  uint16_t ms;
+
+  just_pressed = 0;
+  just_released = 0;
+  while (true) {
+    if (tail != input_head) {
+      volatile ButtonEvent *event = &input_queue[tail & (INPUT_QUEUE_SIZE - 1)];
+      now = event->buttons;
+      ms = event->ms;
+      input_tail = ++tail;
+    }
+    else if (last != input_sampled) {  // a change dropped from a full queue
+      now = input_sampled;
+      ms = millis();
+    }
+    else {
+      break;
+    }
+    down = now & ~last;
+    just_pressed |= down;
+    just_released |= last & ~now;
+    for (uint8_t i = 0; down; i++, down >>= 1) {
+      if (down & 1) press_ms[i] = ms;
+    }
+    last = now;
+  }
+  button_state = last;
+  // after the loop, so no event handled here is later than poll_ms
+  last_poll_ms = poll_ms;
+  poll_ms = millis();
+}
+
+// returns true if the buttons have changed since the last pollButtons()
+boolean Arduboy::buttonsWaiting()
+{
+  return input_tail != input_head || input_sampled != button_state;
+}
+
+uint8_t Arduboy::buttonState()
+{
+  return button_state;
+}
+
 // returns true if the button mask passed in is pressed
 //
 //   if (pressed(LEFT_BUTTON + A_BUTTON))
 boolean Arduboy::pressed(uint8_t buttons)
 {
- uint8_t button_state = getInput();
  return (button_state & buttons) == buttons;
 }
 
@@ -832,10 +1141,79 @@ boolean Arduboy::pressed(uint8_t buttons)
 //   if (not_pressed(LEFT_BUTTON))
 boolean Arduboy::not_pressed(uint8_t buttons)
 {
- uint8_t button_state = getInput();
  return (button_state & buttons) == 0;
 }
 
+// returns true if the buttons went down since the last pollButtons()
+//
+//   if (justPressed(A_BUTTON))
+boolean Arduboy::justPressed(uint8_t buttons)
+{
+ return (just_pressed & buttons) == buttons;
+}
+
+// returns true if the buttons came up since the last pollButtons()
+boolean Arduboy::justReleased(uint8_t buttons)
+{
+ return (just_released & buttons) == buttons;
+}
+
+// returns true if any button went down or came up since the last
+// pollButtons()
+boolean Arduboy::buttonsChanged()
+{
+ return just_pressed | just_released;
+}
+
+// low 16 bits of millis() when a single button last went down
+uint16_t Arduboy::pressedAt(uint8_t button)
+{
+  uint8_t i = 0;
+  while (button > 1) {
+    button >>= 1;
+    i++;
+  }
+  return press_ms[i];
+}
+
+// Repeats due after a button has been held for ms: one after
+// KEY_REPEAT_DELAY, one every KEY_REPEAT_RATE ms until KEY_REPEAT_ACCEL,
+// then one every KEY_REPEAT_FAST ms.
+static uint16_t keyRepeats(uint16_t ms)
+{
+  if (ms < KEY_REPEAT_DELAY)
+    return 0;
+  if (ms < KEY_REPEAT_ACCEL)
+    return 1 + (ms - KEY_REPEAT_DELAY) / KEY_REPEAT_RATE;
+  return 1 + (KEY_REPEAT_ACCEL - KEY_REPEAT_DELAY) / KEY_REPEAT_RATE
+    + (ms - KEY_REPEAT_ACCEL) / KEY_REPEAT_FAST;
+}
+
+// How many times a single button should act this frame: once when it goes
+// down, then for every repeat that fell due since the last pollButtons().
+// The count follows the clock, not the number of frames, so a held button
+// moves just as far at any frame rate.
+//
+//   for (n = repeatCount(LEFT_BUTTON); n; n--) x--;
+uint8_t Arduboy::repeatCount(uint8_t button)
+{
+  uint8_t count = (just_pressed & button) ? 1 : 0;
+  uint16_t down = pressedAt(button);
+  uint16_t held, before;
+
+  if (!(button_state & button))
+    return count;
+  held = poll_ms - down;
+  // nothing was due at the last poll if the button went down since
+  before = count ? 0 : last_poll_ms - down;
+  if (held < before)  // held so long that the 16 bit clock wrapped
+    return count;
+  held = keyRepeats(held) - keyRepeats(before);
+  if (held > KEY_REPEAT_MAX - count)
+    held = KEY_REPEAT_MAX - count;
+  return count + held;
+}
+
 
 uint8_t Arduboy::getInput()
 {
@@ -869,18 +1247,35 @@ void Arduboy::flipPixel(int x, int y) {
   sBuffer[(y*WIDTH) + x] ^= enable;
 } 
 
-void Arduboy::drawScreen1X(uint8_t xcur, uint8_t ycur) {
+void Arduboy::drawScreen1X(uint8_t xcur, uint8_t ycur, bool cursor) {
   
   uint8_t remainder = ycur & B00000111;
   ycur = ycur >> 3;
-  uint8_t enable = B00000001 << remainder;
+  uint8_t enable = cursor ? B00000001 << remainder : 0;
   
   sBuffer[(ycur*WIDTH) + xcur] ^= enable;
-  display();
+  if (overlay_mode) {
+    PROFILE(PROFILE_PUSH);
+    pushBegin();
+    // one screen pixel per canvas pixel, so onion pixels are dimmed
+    // with a checkerboard instead of a partial block
+    for (uint8_t page = 0; page < HEIGHT/8; page++) {
+      for (uint8_t x = 0; x < WIDTH; x++) {
+        uint8_t onion;
+        uint8_t out = screenByte(x, page, onion);
+        transfer(out | (onion & ((x & 1) ? 0xAA : 0x55)));
+      }
+    }
+    pushEnd();
+  } else {
+    display();
+  }
   sBuffer[(ycur*WIDTH) + xcur] ^= enable;
 } 
 
-void Arduboy::drawScreen2X(uint8_t xcur, uint8_t ycur) {
+void Arduboy::drawScreen2X(uint8_t xcur, uint8_t ycur, bool cursor) {
+  PROFILE(PROFILE_PUSH);
+  pushBegin();
   uint8_t x_width = 64;
   uint8_t y_width = 32;
 
@@ -889,15 +1284,19 @@ void Arduboy::drawScreen2X(uint8_t xcur, uint8_t ycur) {
   uint8_t x;
   uint8_t y;
   uint8_t tmp;
+  uint8_t ovl;
   uint8_t out;
+  uint8_t dim;
   
    for(y = y_start; y < y_start + y_width; y += 4) {
      for(x = x_start; x < x_start + x_width; x++) {
-      tmp = sBuffer[((y >> 3)*WIDTH) + x];
+      tmp = screenByte(x, y >> 3, ovl);
       if (y & B00000100) {
          tmp = tmp >> 4;
+         ovl = ovl >> 4;
       } else {
          tmp = tmp & B00001111; 
+         ovl = ovl & B00001111;
       }
       
       out = 0;
@@ -905,36 +1304,46 @@ void Arduboy::drawScreen2X(uint8_t xcur, uint8_t ycur) {
       if (tmp & B00000100) { out |= B00110000;}
       if (tmp & B00000010) { out |= B00001100;}
       if (tmp & B00000001) { out |= B00000011;}
+
+      // onion skin pixels light a single dot of their 2x2 block
+      dim = 0;
+      if (ovl & B00001000) { dim |= B10000000;}
+      if (ovl & B00000100) { dim |= B00100000;}
+      if (ovl & B00000010) { dim |= B00001000;}
+      if (ovl & B00000001) { dim |= B00000010;}
       
-      if (x == xcur && y == (ycur & B11111100)) {
+      if (cursor && x == xcur && y == (ycur & B11111100)) {
         ycur = ycur & B00000011;
         switch (ycur) {
           case 0:
-            SPI.transfer(out ^ B00000010);
-            SPI.transfer(out ^ B00000001);
+            transfer((out | dim) ^ B00000010);
+            transfer(out ^ B00000001);
             break;
           case 1:
-            SPI.transfer(out ^ B00001000);
-            SPI.transfer(out ^ B00000100);
+            transfer((out | dim) ^ B00001000);
+            transfer(out ^ B00000100);
             break;
           case 2:
-            SPI.transfer(out ^ B00100000);
-            SPI.transfer(out ^ B00010000);
+            transfer((out | dim) ^ B00100000);
+            transfer(out ^ B00010000);
             break;
           case 3: 
-            SPI.transfer(out ^ B10000000);
-            SPI.transfer(out ^ B01000000);
+            transfer((out | dim) ^ B10000000);
+            transfer(out ^ B01000000);
             break; 
         }
       } else {     
-        SPI.transfer(out);
-        SPI.transfer(out);
+        transfer(out | dim);
+        transfer(out);
       } 
     }
   }
+  pushEnd();
 }
 
-void Arduboy::drawScreen4X(uint8_t xcur, uint8_t ycur) {
+void Arduboy::drawScreen4X(uint8_t xcur, uint8_t ycur, bool cursor) {
+  PROFILE(PROFILE_PUSH);
+  pushBegin();
   uint8_t x_width = 32;
   uint8_t y_width = 16;
 
@@ -942,58 +1351,146 @@ void Arduboy::drawScreen4X(uint8_t xcur, uint8_t ycur) {
   uint8_t x;
   uint8_t y;
   uint8_t tmp;
+  uint8_t ovl;
   uint8_t out;
+  uint8_t dim;
   uint8_t sequence;
   
    for(y = y_start; y < y_start + y_width; y += 2) {
      for(x = x_start; x < x_start + x_width; x++) {
-      tmp = sBuffer[((y >> 3)*WIDTH) + x];
+      tmp = screenByte(x, y >> 3, ovl);
       
       sequence = y & B00000110;
-      
-      switch (sequence) {
-        case 6:
-          tmp = (tmp & B11000000) >> 6;          
-          break;
-        case 4:
-          tmp = (tmp & B00110000) >> 4;
-          break;
-        case 2:
-          tmp = (tmp & B00001100) >> 2;
-          break;
-        case 0:
-          tmp = (tmp & B00000011);
-          break;
-      }
+      tmp = (tmp >> sequence) & B00000011;
+      ovl = (ovl >> sequence) & B00000011;
            
       out = 0;
       if (tmp & B00000010) { out |= B11110000;}
       if (tmp & B00000001) { out |= B00001111;}
+
+      // onion skin pixels light the middle 2x2 of their 4x4 block
+      dim = 0;
+      if (ovl & B00000010) { dim |= B01100000;}
+      if (ovl & B00000001) { dim |= B00000110;}
       
-      if (x == xcur && y == (ycur & B11111110)) {
+      if (cursor && x == xcur && y == (ycur & B11111110)) {
         ycur = ycur & B00000001;
         switch (ycur) {
           case 1:
-            SPI.transfer(out ^ B10010000);
-            SPI.transfer(out ^ B01100000);
-            SPI.transfer(out ^ B01100000);
-            SPI.transfer(out ^ B10010000);
+            transfer(out ^ B10010000);
+            transfer((out | dim) ^ B01100000);
+            transfer((out | dim) ^ B01100000);
+            transfer(out ^ B10010000);
             break;
           case 0:
-            SPI.transfer(out ^ B00001001);
-            SPI.transfer(out ^ B00000110);
-            SPI.transfer(out ^ B00000110);
-            SPI.transfer(out ^ B00001001);
+            transfer(out ^ B00001001);
+            transfer((out | dim) ^ B00000110);
+            transfer((out | dim) ^ B00000110);
+            transfer(out ^ B00001001);
             break;
         }
       } else {     
-        SPI.transfer(out);
-        SPI.transfer(out);
-        SPI.transfer(out);
-        SPI.transfer(out);
+        transfer(out);
+        transfer(out | dim);
+        transfer(out | dim);
+        transfer(out);
       } 
     }
   } 
+  pushEnd();
+}
+
+// An overlay is a page ordered bitmap in RAM (drawBitmap() layout)
+// that the drawScreen renderers composite into the SPI stream at
+// (x, y) without touching sBuffer.  An onion skin shows dimmed under
+// the canvas, a paste replaces the canvas pixels it covers.  stride is
+// the bitmap's full width when only its left part is shown.
+void Arduboy::setOverlay(const uint8_t *bitmap, uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t mode, uint8_t stride)
+{
+  overlay = bitmap;
+  overlay_x = x;
+  overlay_y = y;
+  overlay_width = width;
+  overlay_height = height;
+  overlay_pages = (height + 7) >> 3;
+  overlay_stride = stride ? stride : width;
+  overlay_mode = mode;
+}
+
+void Arduboy::clearOverlay()
+{
+  overlay_mode = OVERLAY_NONE;
+}
+
+// overlay pixels falling into screen page `page` at column x
+uint8_t Arduboy::overlayByte(uint8_t x, uint8_t page)
+{
+  if (x < overlay_x || x >= overlay_x + overlay_width)
+  {
+    return 0;
+  }
+
+  const uint8_t *col = overlay + (x - overlay_x);
+  int8_t top = (page << 3) - overlay_y;
+  uint8_t data = 0;
+  if (top < 0)
+  {
+    if (top > -8) { data = col[0] << -top; }
+    return data;
+  }
+
+  uint8_t p = top >> 3;
+  uint8_t offset = top & B00000111;
+  if (p < overlay_pages)
+  {
+    data = col[p*overlay_stride] >> offset;
+  }
+  if (offset && p + 1 < overlay_pages)
+  {
+    data |= col[(p+1)*overlay_stride] << (8 - offset);
+  }
+  return data;
+}
+
+// rows of screen page `page` covered by the overlay at column x
+uint8_t Arduboy::overlayMask(uint8_t x, uint8_t page)
+{
+  if (x < overlay_x || x >= overlay_x + overlay_width)
+  {
+    return 0;
+  }
+
+  int8_t top = overlay_y - (page << 3);
+  int8_t bottom = top + overlay_height;
+  if (bottom <= 0 || top >= 8)
+  {
+    return 0;
+  }
+  uint8_t mask = 0xFF;
+  if (top > 0) { mask <<= top; }
+  if (bottom < 8) { mask &= 0xFF >> (8 - bottom); }
+  return mask;
+}
+
+// screen byte with any paste overlay applied, onion skin pixels that
+// fall on unlit canvas pixels are returned separately for dimming
+uint8_t Arduboy::screenByte(uint8_t x, uint8_t page, uint8_t &onion)
+{
+  uint8_t data = sBuffer[(page*WIDTH) + x];
+  onion = 0;
+  if (overlay_mode == OVERLAY_ONION)
+  {
+    onion = overlayByte(x, page) & ~data;
+  }
+  else if (overlay_mode == OVERLAY_PASTE)
+  {
+    uint8_t mask = overlayMask(x, page);
+    if (mask)
+    {
+      data = (data & ~mask) | (overlayByte(x, page) & mask);
+    }
+  }
+  return data;
 }
 
 void Arduboy::prepZoomSwitch(uint8_t zoom) 
@@ -1030,6 +1527,15 @@ void Arduboy::scrollScreen(uint8_t xcur, uint8_t ycur, uint8_t width, uint8_t he
   }  
 }
 
+// Keep serial output to one burst per 50ms.  The time spent printing
+// counts towards the gap, and the rest of it is slept through.
+void Arduboy::paceSerial()
+{
+  while (!tunes.delayDone())
+    idle();
+  tunes.startDelay(50);
+}
+
 void Arduboy::writeCode(uint8_t width, uint8_t height)
 {
   Serial.print (F("const static unsigned char image[] PROGMEM =\n{\n"));
@@ -1053,7 +1559,7 @@ void Arduboy::writeCode(uint8_t width, uint8_t height)
         b1 = b1 + b2;
         if((count & B00000111) == 0)
         {
-          tunes.delay(50);
+          paceSerial();
           Serial.print("\n");
         }
         Serial.print("0x");
@@ -1072,14 +1578,14 @@ void Arduboy::writeCode(uint8_t width, uint8_t height)
           b1 = sBuffer[(j*WIDTH) + (uint8_t)i];          
           if((count & B00000111) == 0)
           {
-            tunes.delay(50);
+            paceSerial();
             Serial.print("\n  ");
           }
           Serial.print("0x");
           print2Hex(b1);
           if (i != 71 || j != 4)
           {
-            tunes.delay(50);
+            paceSerial();
             Serial.print(", ");
           }
           count++;
@@ -1094,14 +1600,14 @@ void Arduboy::writeCode(uint8_t width, uint8_t height)
           b1 = sBuffer[(j*WIDTH) + (uint8_t)i];          
           if((count & B00000111) == 0)
           {
-            tunes.delay(50);
+            paceSerial();
             Serial.print("\n  ");
           }
           Serial.print("0x");
           print2Hex(b1);
           if (i != 79 || j != 5)
           {
-            tunes.delay(50);
+            paceSerial();
             Serial.print(", ");
           }
           count++;
@@ -1116,14 +1622,14 @@ void Arduboy::writeCode(uint8_t width, uint8_t height)
           b1 = sBuffer[(j*WIDTH) + (uint8_t)i];          
           if((count & B00000111) == 0)
           {
-            tunes.delay(50);
+            paceSerial();
             Serial.print("\n  ");
           }
           Serial.print("0x");
           print2Hex(b1);
           if (i != 95 || j != 7)
           {
-            tunes.delay(50);
+            paceSerial();
             Serial.print(", ");
           }
           count++;
@@ -1131,21 +1637,21 @@ void Arduboy::writeCode(uint8_t width, uint8_t height)
       }
       break;
     case 128:
-      for(j = 0; j < 128; j++)
+      for(j = 0; j < 8; j++)
       {
-        for(i = 0; i < 8; i++)
+        for(i = 0; i < 128; i++)
         {
           b1 = sBuffer[(j*WIDTH) + (uint8_t)i];          
           if((count & B00000111) == 0)
           {
-            tunes.delay(50);
+            paceSerial();
             Serial.print("\n  ");
           }
           Serial.print("0x");
           print2Hex(b1);
           if (i != 127 || j != 7)
           {
-            tunes.delay(50);
+            paceSerial();
             Serial.print(", ");
           }
           count++;
@@ -1158,6 +1664,41 @@ void Arduboy::writeCode(uint8_t width, uint8_t height)
 }
 
 
+// Prints a RAM image (or several stacked frames of one) in the same
+// format as writeCode(width, height), with a leading comment giving the
+// frame size so a sprite sheet can be told apart from a larger canvas.
+void Arduboy::writeCode(const uint8_t *image, uint8_t width, uint8_t height, uint8_t frames)
+{
+  uint16_t length = width * ((height + 7) >> 3) * frames;
+
+  Serial.print(F("// sprite sheet: "));
+  Serial.print(frames, DEC);
+  Serial.print(F(" frames of "));
+  Serial.print(width, DEC);
+  Serial.print('x');
+  Serial.print(height, DEC);
+  Serial.print('\n');
+  Serial.print (F("const static unsigned char image[] PROGMEM =\n{\n"));
+
+  for (uint16_t n = 0; n < length; n++)
+  {
+    if((n & B00000111) == 0)
+    {
+      paceSerial();
+      Serial.print("\n  ");
+    }
+    Serial.print("0x");
+    print2Hex(image[n]);
+    if (n != length - 1)
+    {
+      Serial.print(", ");
+    }
+  }
+
+  Serial.print (F("\n};\n"));  
+}
+
+
 void Arduboy::writeSVG(uint8_t width, uint8_t height)
 {
   int wval = width * 5 + 1;
@@ -1174,7 +1715,6 @@ void Arduboy::writeSVG(uint8_t width, uint8_t height)
 
   uint8_t i;
   uint8_t j;
-  uint8_t count = 0;
   uint8_t b1;
   uint8_t b2;
   
@@ -1385,3 +1925,432 @@ void Arduboy::print2Hex(uint8_t ch)
    }
    Serial.print(ch, HEX);
 }
+
+// 8 vertical pixels starting at (x, y), bit 0 is the top pixel. y does
+// not need to be page aligned, the byte is stitched from two pages the
+// same way drawBitmap() splits them.
+uint8_t Arduboy::getColumnByte(uint8_t x, uint8_t y)
+{
+  uint8_t page = y >> 3;
+  uint8_t offset = y & B00000111;
+  uint8_t data = sBuffer[(page*WIDTH) + x] >> offset;
+  if (offset && page < (HEIGHT/8)-1)
+  {
+    data |= sBuffer[((page+1)*WIDTH) + x] << (8 - offset);
+  }
+  return data;
+}
+
+// Only the bits set in mask are written, the rest of the column keeps
+// its pixels.
+void Arduboy::setColumnByte(uint8_t x, uint8_t y, uint8_t data, uint8_t mask)
+{
+  uint8_t page = y >> 3;
+  uint8_t offset = y & B00000111;
+  uint8_t *b = &sBuffer[(page*WIDTH) + x];
+  data &= mask;
+  *b = (*b & ~(mask << offset)) | (data << offset);
+  if (offset && page < (HEIGHT/8)-1)
+  {
+    b += WIDTH;
+    *b = (*b & ~(mask >> (8 - offset))) | (data >> (8 - offset));
+  }
+}
+
+// Copy a rectangle at any alignment into a packed page ordered bitmap
+// (drawBitmap() layout), bits below the last row are left clear.
+void Arduboy::copyRegion(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t *dest)
+{
+  for (uint8_t p = 0; p < height; p += 8)
+  {
+    uint8_t mask = (height - p < 8) ? 0xFF >> (8 - (height - p)) : 0xFF;
+    for (uint8_t i = 0; i < width; i++)
+    {
+      *dest++ = getColumnByte(x + i, y + p) & mask;
+    }
+  }
+}
+
+// Opaque blit of a packed bitmap to any (x, y).  Each source byte is
+// split over two screen pages by the y offset just as drawBitmap() does,
+// so the cost is per byte whatever the alignment.  Only width columns
+// and height rows of the source (stride bytes wide) are written.
+void Arduboy::pasteRegion(const uint8_t *src, uint8_t stride, uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+  for (uint8_t p = 0; p < height && y + p < HEIGHT; p += 8, src += stride)
+  {
+    uint8_t mask = (height - p < 8) ? 0xFF >> (8 - (height - p)) : 0xFF;
+    for (uint8_t i = 0; i < width && x + i < WIDTH; i++)
+    {
+      setColumnByte(x + i, y + p, src[i], mask);
+    }
+  }
+}
+
+// Receive an image in the format writeHex() emits: width byte, height
+// byte, then the column bytes page by page.  Characters are fed in one
+// at a time so nothing is buffered, each data byte goes straight into
+// the canvas at (x, y).  The header must match the canvas size or the
+// stream is rejected before the canvas is touched.
+void Arduboy::beginImport(uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+  import_x = x;
+  import_y = y;
+  import_width = width;
+  import_height = height;
+  import_phase = 0;
+  import_value = 0;
+  import_col = 0;
+  import_page = 0;
+}
+
+uint8_t Arduboy::importHex(uint8_t c)
+{
+  uint8_t nibble;
+
+  // stream already finished, ignore anything trailing it
+  if (import_phase == 0xFF) return IMPORT_DONE;
+  if (import_phase == 0xFE) return IMPORT_ERROR;
+
+  if (c >= '0' && c <= '9')
+  {
+    nibble = c - '0';
+  }
+  else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+  {
+    nibble = (c | 0x20) - 'a' + 10;
+  }
+  else if (c == '\n' || c == '\r' || c == ' ')
+  {
+    // whitespace is only valid between bytes
+    return (import_phase & 1) ? importFail() : IMPORT_BUSY;
+  }
+  else
+  {
+    return importFail();
+  }
+
+  // even phases hold the high nibble, odd phases complete a byte
+  if (!(import_phase & 1))
+  {
+    import_value = nibble << 4;
+    import_phase++;
+    return IMPORT_BUSY;
+  }
+  import_value |= nibble;
+  import_phase++;
+
+  switch (import_phase)
+  {
+    case 2:
+      return (import_value == import_width) ? IMPORT_BUSY : importFail();
+    case 4:
+      return (import_value == import_height) ? IMPORT_BUSY : importFail();
+  }
+
+  setColumnByte(import_x + import_col, import_y + (import_page << 3), import_value);
+  import_phase = 4;
+  if (++import_col == import_width)
+  {
+    import_col = 0;
+    if (++import_page == (import_height + 7) >> 3)
+    {
+      import_phase = 0xFF;
+      return IMPORT_DONE;
+    }
+  }
+  return IMPORT_BUSY;
+}
+
+uint8_t Arduboy::importFail()
+{
+  import_phase = 0xFE;
+  return IMPORT_ERROR;
+}
+
+/* Region Transforms */
+
+// Each byte reversed, used by flipVertical() to mirror a page.
+const static uint8_t bit_reverse[256] PROGMEM =
+{
+  0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0, 0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0,
+  0x08, 0x88, 0x48, 0xC8, 0x28, 0xA8, 0x68, 0xE8, 0x18, 0x98, 0x58, 0xD8, 0x38, 0xB8, 0x78, 0xF8,
+  0x04, 0x84, 0x44, 0xC4, 0x24, 0xA4, 0x64, 0xE4, 0x14, 0x94, 0x54, 0xD4, 0x34, 0xB4, 0x74, 0xF4,
+  0x0C, 0x8C, 0x4C, 0xCC, 0x2C, 0xAC, 0x6C, 0xEC, 0x1C, 0x9C, 0x5C, 0xDC, 0x3C, 0xBC, 0x7C, 0xFC,
+  0x02, 0x82, 0x42, 0xC2, 0x22, 0xA2, 0x62, 0xE2, 0x12, 0x92, 0x52, 0xD2, 0x32, 0xB2, 0x72, 0xF2,
+  0x0A, 0x8A, 0x4A, 0xCA, 0x2A, 0xAA, 0x6A, 0xEA, 0x1A, 0x9A, 0x5A, 0xDA, 0x3A, 0xBA, 0x7A, 0xFA,
+  0x06, 0x86, 0x46, 0xC6, 0x26, 0xA6, 0x66, 0xE6, 0x16, 0x96, 0x56, 0xD6, 0x36, 0xB6, 0x76, 0xF6,
+  0x0E, 0x8E, 0x4E, 0xCE, 0x2E, 0xAE, 0x6E, 0xEE, 0x1E, 0x9E, 0x5E, 0xDE, 0x3E, 0xBE, 0x7E, 0xFE,
+  0x01, 0x81, 0x41, 0xC1, 0x21, 0xA1, 0x61, 0xE1, 0x11, 0x91, 0x51, 0xD1, 0x31, 0xB1, 0x71, 0xF1,
+  0x09, 0x89, 0x49, 0xC9, 0x29, 0xA9, 0x69, 0xE9, 0x19, 0x99, 0x59, 0xD9, 0x39, 0xB9, 0x79, 0xF9,
+  0x05, 0x85, 0x45, 0xC5, 0x25, 0xA5, 0x65, 0xE5, 0x15, 0x95, 0x55, 0xD5, 0x35, 0xB5, 0x75, 0xF5,
+  0x0D, 0x8D, 0x4D, 0xCD, 0x2D, 0xAD, 0x6D, 0xED, 0x1D, 0x9D, 0x5D, 0xDD, 0x3D, 0xBD, 0x7D, 0xFD,
+  0x03, 0x83, 0x43, 0xC3, 0x23, 0xA3, 0x63, 0xE3, 0x13, 0x93, 0x53, 0xD3, 0x33, 0xB3, 0x73, 0xF3,
+  0x0B, 0x8B, 0x4B, 0xCB, 0x2B, 0xAB, 0x6B, 0xEB, 0x1B, 0x9B, 0x5B, 0xDB, 0x3B, 0xBB, 0x7B, 0xFB,
+  0x07, 0x87, 0x47, 0xC7, 0x27, 0xA7, 0x67, 0xE7, 0x17, 0x97, 0x57, 0xD7, 0x37, 0xB7, 0x77, 0xF7,
+  0x0F, 0x8F, 0x4F, 0xCF, 0x2F, 0xAF, 0x6F, 0xEF, 0x1F, 0x9F, 0x5F, 0xDF, 0x3F, 0xBF, 0x7F, 0xFF
+};
+
+// The transforms work on whole bytes in place.  A page aligned region
+// is used straight out of sBuffer, one whose top edge falls inside a
+// page (the 8x8 canvas) is gathered into the caller's stage buffer
+// first and written back by regionEnd().  Heights are multiples of 8.
+uint8_t *Arduboy::regionBegin(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t *stage, uint8_t &stride)
+{
+  if (!(y & B00000111))
+  {
+    stride = WIDTH;
+    return &sBuffer[((y >> 3)*WIDTH) + x];
+  }
+  if (width * (height >> 3) > REGION_STAGE_SIZE)
+  {
+    return 0;
+  }
+
+  uint8_t *b = stage;
+  for (uint8_t p = 0; p < height; p += 8)
+  {
+    for (uint8_t i = 0; i < width; i++)
+    {
+      *b++ = getColumnByte(x + i, y + p);
+    }
+  }
+  stride = width;
+  return stage;
+}
+
+void Arduboy::regionEnd(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t *stage)
+{
+  if (!(y & B00000111))
+  {
+    return;
+  }
+  for (uint8_t p = 0; p < height; p += 8)
+  {
+    for (uint8_t i = 0; i < width; i++)
+    {
+      setColumnByte(x + i, y + p, *stage++);
+    }
+  }
+}
+
+// mirror left to right: swap columns from the outside in
+void Arduboy::flipHorizontal(uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+  uint8_t stage[REGION_STAGE_SIZE];
+  uint8_t stride;
+  uint8_t *row = regionBegin(x, y, width, height, stage, stride);
+  if (!row) return;
+
+  for (uint8_t p = 0; p < (height >> 3); p++, row += stride)
+  {
+    uint8_t *a = row;
+    uint8_t *b = row + width - 1;
+    while (a < b)
+    {
+      uint8_t t = *a;
+      *a++ = *b;
+      *b-- = t;
+    }
+  }
+  regionEnd(x, y, width, height, stage);
+}
+
+// mirror top to bottom: swap pages from the outside in, reversing the
+// bits of every byte on the way
+void Arduboy::flipVertical(uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+  uint8_t stage[REGION_STAGE_SIZE];
+  uint8_t stride;
+  uint8_t *buf = regionBegin(x, y, width, height, stage, stride);
+  if (!buf) return;
+
+  uint8_t pages = height >> 3;
+  for (uint8_t i = 0; i < width; i++)
+  {
+    uint8_t *a = buf + i;
+    uint8_t *b = buf + ((pages - 1) * stride) + i;
+    while (a < b)
+    {
+      uint8_t t = pgm_read_byte(bit_reverse + *a);
+      *a = pgm_read_byte(bit_reverse + *b);
+      *b = t;
+      a += stride;
+      b -= stride;
+    }
+    if (a == b)
+    {
+      *a = pgm_read_byte(bit_reverse + *a);
+    }
+  }
+  regionEnd(x, y, width, height, stage);
+}
+
+// Rotate a square region 90 degrees clockwise, any other region is left
+// as it is.  The region is split into 8x8 blocks (8 column bytes each).
+// Blocks move round in cycles of four and each one is turned by a bit
+// matrix transpose followed by reversing its columns.
+static void rotateBlock(const uint8_t *src, uint8_t *out)
+{
+  uint8_t t[8] = { 0 };
+  for (uint8_t c = 0; c < 8; c++)
+  {
+    uint8_t b = src[c];
+    for (uint8_t r = 0; r < 8; r++)
+    {
+      t[r] = (t[r] >> 1) | (b << 7);
+      b >>= 1;
+    }
+  }
+  for (uint8_t c = 0; c < 8; c++)
+  {
+    out[c] = t[7 - c];
+  }
+}
+
+void Arduboy::rotate90(uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+  if (width != height) return;
+
+  uint8_t stage[REGION_STAGE_SIZE];
+  uint8_t stride;
+  uint8_t *buf = regionBegin(x, y, width, height, stage, stride);
+  if (!buf) return;
+
+  uint8_t n = width >> 3;
+  uint8_t held[8];
+  uint8_t turned[8];
+
+  // block (bx, by) lands on (n-1-by, bx), walk the rings of blocks
+  for (uint8_t ring = 0; ring < (n >> 1); ring++)
+  {
+    for (uint8_t i = ring; i < n - 1 - ring; i++)
+    {
+      uint8_t *a = buf + (ring * stride) + (i << 3);
+      uint8_t *b = buf + (i * stride) + ((n - 1 - ring) << 3);
+      uint8_t *c = buf + ((n - 1 - ring) * stride) + ((n - 1 - i) << 3);
+      uint8_t *d = buf + ((n - 1 - i) * stride) + (ring << 3);
+
+      memcpy(held, d, 8);
+      rotateBlock(c, d);
+      rotateBlock(b, c);
+      rotateBlock(a, b);
+      rotateBlock(held, a);
+    }
+  }
+  if (n & 1)
+  {
+    uint8_t *m = buf + ((n >> 1) * stride) + ((n >> 1) << 3);
+    rotateBlock(m, turned);
+    memcpy(m, turned, 8);
+  }
+  regionEnd(x, y, width, height, stage);
+}
+
+// Shift with wrap around.  dx moves whole columns by reversing each
+// page row in three parts, dy (-7..7) carries bits from page to page
+// down each column and feeds the last carry back in at the other end.
+static void reverseBytes(uint8_t *a, uint8_t *b)
+{
+  while (a < b)
+  {
+    uint8_t t = *a;
+    *a++ = *b;
+    *b-- = t;
+  }
+}
+
+void Arduboy::shiftRegion(uint8_t x, uint8_t y, uint8_t width, uint8_t height, int8_t dx, int8_t dy)
+{
+  uint8_t stage[REGION_STAGE_SIZE];
+  uint8_t stride;
+  uint8_t *buf = regionBegin(x, y, width, height, stage, stride);
+  if (!buf) return;
+
+  uint8_t pages = height >> 3;
+  int16_t k = dx % width;
+  if (k < 0) k += width;
+  if (k)
+  {
+    for (uint8_t p = 0; p < pages; p++)
+    {
+      uint8_t *row = buf + (p * stride);
+      reverseBytes(row, row + width - 1);
+      reverseBytes(row, row + k - 1);
+      reverseBytes(row + k, row + width - 1);
+    }
+  }
+
+  if (dy > 0)
+  {
+    for (uint8_t i = 0; i < width; i++)
+    {
+      uint8_t carry = 0;
+      for (uint8_t p = 0; p < pages; p++)
+      {
+        uint8_t *b = buf + (p * stride) + i;
+        uint8_t out = *b >> (8 - dy);
+        *b = (*b << dy) | carry;
+        carry = out;
+      }
+      buf[i] |= carry;
+    }
+  }
+  else if (dy < 0)
+  {
+    uint8_t s = -dy;
+    for (uint8_t i = 0; i < width; i++)
+    {
+      uint8_t carry = 0;
+      for (uint8_t p = pages; p-- > 0; )
+      {
+        uint8_t *b = buf + (p * stride) + i;
+        uint8_t out = *b << (8 - s);
+        *b = (*b >> s) | carry;
+        carry = out;
+      }
+      buf[((pages - 1) * stride) + i] |= carry;
+    }
+  }
+  regionEnd(x, y, width, height, stage);
+}
+
+// one pass over the region a byte at a time
+void Arduboy::invertRegion(uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+  uint8_t stage[REGION_STAGE_SIZE];
+  uint8_t stride;
+  uint8_t *row = regionBegin(x, y, width, height, stage, stride);
+  if (!row) return;
+
+  for (uint8_t p = 0; p < (height >> 3); p++, row += stride)
+  {
+    for (uint8_t i = 0; i < width; i++)
+    {
+      row[i] ^= 0xFF;
+    }
+  }
+  regionEnd(x, y, width, height, stage);
+}
+
+
+/* Interrupts */
+
+// System tick, ~1kHz.  Runs the music sequencer and samples the buttons,
+// which is the only way to see right, A and B change.
+ISR(TIMER0_COMPA_vect)
+{
+  {
+    PROFILE(PROFILE_AUDIO);
+    ArduboyTunes::tick();
+  }
+  Arduboy::sampleButtons();
+}
+
+#ifdef DEVKIT
+// up, left or down changed
+ISR(PCINT0_vect)
+{
+  Arduboy::sampleButtons();
+}
+#endif
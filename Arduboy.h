@@ -19,19 +19,24 @@
 
 // eeprom settings above are neded for audio
 #include "audio.h"
+#include "telemetry.h"
 
 #define PIXEL_SAFE_MODE
+// a simulator's button pins can read low, as if all were held, so
+// host/bench-avr.cpp is built with NO_SAFE_MODE
+#ifndef NO_SAFE_MODE
 #define SAFE_MODE
+#endif
 
 #define CS 6
 #define DC 4
 #define RST 12
 
 // compare Vcc to 1.1 bandgap
-#define ADC_VOLTAGE _BV(REFS0) | _BV(MUX4) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1)
+#define ADC_VOLTAGE (_BV(REFS0) | _BV(MUX4) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1))
 // compare temperature to 2.5 internal reference
 // also _BV(MUX5)
-#define ADC_TEMP _BV(REFS0) | _BV(REFS1) | _BV(MUX2) | _BV(MUX1) | _BV(MUX0)
+#define ADC_TEMP (_BV(REFS0) | _BV(REFS1) | _BV(MUX2) | _BV(MUX1) | _BV(MUX0))
 
 #define LEFT_BUTTON _BV(5)
 #define RIGHT_BUTTON _BV(2)
@@ -47,8 +52,16 @@
 #define PIN_A_BUTTON A0
 #define PIN_B_BUTTON A1
 
+#ifdef TUNES_HW_TOGGLE
+#define PIN_SPEAKER_1 5  // OC3A
+#define PIN_SPEAKER_2 9  // OC1A
+#elif defined(TUNES_SYNTH)
+#define PIN_SPEAKER_1 9  // OC1A, every synth voice is mixed onto it
+#define PIN_SPEAKER_2 9
+#else
 #define PIN_SPEAKER_1 A2
 #define PIN_SPEAKER_2 A3
+#endif
 
 #define WIDTH 128
 #define HEIGHT 64
@@ -59,6 +72,53 @@
 #define COLUMN_ADDRESS_END (WIDTH - 1) & 0x7F
 #define PAGE_ADDRESS_END ((HEIGHT/8)-1) & 0x07
 
+// importHex() results
+#define IMPORT_BUSY 0
+#define IMPORT_DONE 1
+#define IMPORT_ERROR 2
+
+// setOverlay() modes
+#define OVERLAY_NONE 0
+#define OVERLAY_ONION 1
+#define OVERLAY_PASTE 2
+
+// unaligned regions up to this many bytes can be transformed
+#define REGION_STAGE_SIZE 32
+
+// nextFrame() keeps a histogram of frame durations in this many buckets
+// of FRAME_HISTOGRAM_US, the last bucket counts every longer frame
+#define FRAME_HISTOGRAM_BUCKETS 8
+#define FRAME_HISTOGRAM_US 4000
+
+// pushBegin()/pushEnd() keep a histogram of frame push times in this
+// many buckets of SPI_PUSH_US, the last bucket counts every longer push
+#define SPI_PUSH_BUCKETS 8
+#define SPI_PUSH_US 500
+
+// start() fills free RAM with this so stackHighWater() can find how far
+// the stack has grown, leaving STACK_PAINT_MARGIN bytes below its own frame
+#define STACK_CANARY 0xC5
+#define STACK_PAINT_MARGIN 8
+
+// button changes held between pollButtons() calls, a power of two
+#define INPUT_QUEUE_SIZE 8
+
+// a change in the buttons, caught by the system tick or a pin change
+struct ButtonEvent
+{
+  uint8_t buttons;
+  uint16_t ms;   // low 16 bits of millis()
+};
+
+// repeatCount() timing in ms: the first repeat, the repeat interval, how
+// long a button is held before repeats speed up, and the faster interval
+#define KEY_REPEAT_DELAY 300
+#define KEY_REPEAT_RATE 80
+#define KEY_REPEAT_ACCEL 1200
+#define KEY_REPEAT_FAST 20
+// most repeats reported at once, after a long frame
+#define KEY_REPEAT_MAX 8
+
 
 class Arduboy : public Print
 {
@@ -66,21 +126,59 @@ public:
   Arduboy();
   void LCDDataMode();
   void LCDCommandMode();
+  // every byte to the display goes through here, to be counted when
+  // PROFILING is defined
+  void transfer(uint8_t data)
+  {
+    SPI.transfer(data);
+#ifdef PROFILING
+    if (lcd_command)
+      spiCommands++;
+    else
+      spiBytes++;
+#endif
+  }
+  void pushBegin();
+  void pushEnd();
+  uint16_t pushHistogram(uint8_t bucket);
+  void clearBusStats();
+  void busSend(Print &out);
+  unsigned long spiBytes = 0;     // data bytes sent, with PROFILING
+  unsigned long spiCommands = 0;  // command bytes sent, with PROFILING
+  uint16_t spiPushes = 0;         // frames sent, see pushBegin()
 
-  uint8_t getInput();
+  static uint8_t getInput();
+  void pollButtons();
+  boolean buttonsWaiting();
+  uint8_t buttonState();
   boolean pressed(uint8_t buttons);
   boolean not_pressed(uint8_t buttons);
+  boolean justPressed(uint8_t buttons);
+  boolean justReleased(uint8_t buttons);
+  boolean buttonsChanged();
+  uint16_t pressedAt(uint8_t button);
+  uint8_t repeatCount(uint8_t button);
+  static void sampleButtons();
   void start();
   void saveMuchPower();
+  void powerDown();
+  static void paintStack();
+  static uint16_t stackHighWater();
+  static uint16_t freeRamMin();
+  static uint16_t freeRam();
+  static void ramSend(Print &out);
+  void wakeSend(Print &out);
   void idle();
   void blank();
   void clearDisplay();
   void display();
   void prepZoomSwitch(uint8_t zoom);
   void scrollScreen(uint8_t xcur, uint8_t ycur, uint8_t width, uint8_t height);
-  void drawScreen1X(uint8_t xcur, uint8_t ycur); 
-  void drawScreen2X(uint8_t xcur, uint8_t ycur); 
-  void drawScreen4X(uint8_t xcur, uint8_t ycur); 
+  void drawScreen1X(uint8_t xcur, uint8_t ycur, bool cursor = true); 
+  void drawScreen2X(uint8_t xcur, uint8_t ycur, bool cursor = true); 
+  void drawScreen4X(uint8_t xcur, uint8_t ycur, bool cursor = true); 
+  void setOverlay(const uint8_t *bitmap, uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t mode, uint8_t stride = 0);
+  void clearOverlay();
   void drawScreen(const unsigned char *image);
   void drawScreen(unsigned char image[]);
   void drawPixel(int x, int y, uint8_t color);
@@ -107,13 +205,25 @@ public:
   void setTextSize(uint8_t s);
   void setTextWrap(boolean w);
   void writeCode(uint8_t width, uint8_t height);
+  void writeCode(const uint8_t *image, uint8_t width, uint8_t height, uint8_t frames);
   void writeHex(uint8_t width, uint8_t height);
   void writeSVG(uint8_t width, uint8_t height);
   void svgWrite();
   void svgByte(uint8_t width, uint8_t height, uint8_t pixel);
   void svgPixel(uint8_t width, uint8_t height);
   void print2Hex(uint8_t ch);
-  inline unsigned char* getBuffer();
+  void beginImport(uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+  uint8_t importHex(uint8_t c);
+  uint8_t getColumnByte(uint8_t x, uint8_t y);
+  void setColumnByte(uint8_t x, uint8_t y, uint8_t data, uint8_t mask = 0xFF);
+  void copyRegion(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t *dest);
+  void pasteRegion(const uint8_t *src, uint8_t stride, uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+  void flipHorizontal(uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+  void flipVertical(uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+  void rotate90(uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+  void shiftRegion(uint8_t x, uint8_t y, uint8_t width, uint8_t height, int8_t dx, int8_t dy);
+  void invertRegion(uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+  unsigned char* getBuffer() { return sBuffer; }
   uint8_t width();
   uint8_t height();
   virtual size_t write(uint8_t);
@@ -125,14 +235,21 @@ public:
 
   void setFrameRate(uint8_t rate);
   bool nextFrame();
+  void frameDone(unsigned long us);
   int cpuLoad();
+  uint16_t frameHistogram(uint8_t bucket);
+  void clearFrameStats();
   uint8_t frameRate = 60;
   uint8_t frameCount = 0;
-  uint8_t eachFrameMillis = 1000/60;
-  long lastFrameStart = 0;
-  long nextFrameStart = 0;
+  unsigned long eachFrameMicros = 1000000UL/60;
+  unsigned long lastFrameStart = 0;
+  unsigned long nextFrameStart = 0;
   bool post_render = false;
   uint8_t lastFrameDurationMs = 0;
+  uint16_t lastFrameDurationUs = 0;
+  uint16_t frameSkips = 0;    // deadlines passed without a frame
+  uint16_t wakeLatencyUs = 0; // powerDown() wake to the end of a frame
+  uint16_t wakes = 0;         // times powerDown() has woken
 
 private:
   unsigned char sBuffer[(HEIGHT*WIDTH)/8];
@@ -146,6 +263,31 @@ private:
   volatile uint8_t *mosiport, *clkport, *csport, *dcport;
   uint8_t mosipinmask, clkpinmask, cspinmask, dcpinmask;
   uint8_t x_start, y_start;
+  // writeHex() import parser state
+  uint8_t import_x, import_y, import_width, import_height;
+  uint8_t import_phase, import_value, import_col, import_page;
+  uint8_t importFail();
+  // bitmap composited into the zoomed screen stream
+  const uint8_t *overlay;
+  uint8_t overlay_x, overlay_y, overlay_width, overlay_height, overlay_pages, overlay_stride;
+  uint8_t overlay_mode = OVERLAY_NONE;
+  uint8_t overlayByte(uint8_t x, uint8_t page);
+  uint8_t overlayMask(uint8_t x, uint8_t page);
+  uint8_t screenByte(uint8_t x, uint8_t page, uint8_t &onion);
+  uint8_t *regionBegin(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t *stage, uint8_t &stride);
+  void regionEnd(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t *stage);
+  void paceSerial();
+  // snapshot taken by pollButtons()
+  uint8_t button_state, just_pressed, just_released;
+  uint16_t press_ms[8];
+  uint16_t poll_ms, last_poll_ms;
+  uint16_t frame_histogram[FRAME_HISTOGRAM_BUCKETS];
+  uint16_t push_histogram[SPI_PUSH_BUCKETS];
+  unsigned long push_start;
+  uint8_t push_depth = 0;
+  bool lcd_command = false;
+  unsigned long wakeStart;
+  bool waking = false;
 // Adafruit stuff
 protected:
   int16_t cursor_x = 0;
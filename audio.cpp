@@ -4,36 +4,46 @@
 const byte PROGMEM tune_pin_to_timer_PGM[] = { 3, 1 };
 volatile byte *_tunes_timer1_pin_port;
 volatile byte _tunes_timer1_pin_mask;
-volatile int32_t timer1_toggle_count;
+volatile int32_t tone_ms_count;                /* countdown tone() duration, -1 forever */
 volatile byte *_tunes_timer3_pin_port;
 volatile byte _tunes_timer3_pin_mask;
 byte _tune_pins[AVAILABLE_TIMERS];
 byte _tune_num_chans = 0;
 volatile boolean tune_playing; // is the score still playing?
-volatile unsigned wait_timer_frequency2;       /* its current frequency */
-volatile unsigned wait_timer_old_frequency2;   /* its previous frequency */
-volatile boolean wait_timer_playing = false;   /* is it currently playing a note? */
-volatile boolean doing_delay = false;          /* are we using it for a tune_delay()? */
+volatile boolean wait_timer_playing = false;   /* is timer 3 sounding a note? */
+volatile boolean delay_waiting = false;        /* set by the sketch, cleared by the tick */
 volatile boolean tonePlaying = false;
-volatile boolean effectPlaying = false;
-volatile boolean effectReady = false;
-volatile unsigned long wait_toggle_count;      /* countdown score waits */
-volatile unsigned long delay_toggle_count;     /* countdown tune_ delay() delays */
+volatile boolean effectPlaying = false;        /* is the effect voice sounding? */
+volatile uint16_t tone_ocr;                    /* the tone(), to sound again after an effect */
+volatile uint8_t tone_bits;
+volatile unsigned delay_ms_count;              /* countdown tune_ delay() delays */
+volatile unsigned tick_us = 0;                 /* microseconds toward the next ms */
 
+static_assert(TUNES_TICK_US * (F_CPU / 1000000UL) == 64UL * 256UL,
+              "TUNES_TICK_US must be one Timer0 cycle");
 
-// pointers to your musical score and your position in said score
-volatile const byte *score_start = 0;
-volatile const byte *score_cursor = 0;
 
-volatile const byte *effect_start = 0;
-volatile const byte *effect_cursor = 0;
+// the score and the effect each run their own cursor and wait
+volatile TuneVoice score_voice;
+volatile TuneVoice effect_voice;
+
+// Commands from the sketch to the sequencer tick.  The sketch only ever
+// writes tune_queue_head and the tick only ever writes tune_queue_tail,
+// so neither side has to mask interrupts.
+volatile TuneCommand tune_queue[TUNE_QUEUE_SIZE];
+volatile byte tune_queue_head = 0;
+volatile byte tune_queue_tail = 0;
+
+// the note the score wants on each channel, kept while an effect has it
+volatile byte score_note[TUNES_CHANNELS];
 
 // Table of midi note frequencies * 2
 //   They are times 2 for greater accuracy, yet still fits in a word.
 //   Generated from Excel by =ROUND(2*440/32*(2^((x-9)/12)),0) for 0<x<128
 // The lowest notes might not work, depending on the Arduino clock frequency
 // Ref: http://www.phy.mtu.edu/~suits/notefreqs.html
-const unsigned int PROGMEM _midi_note_frequencies[128] = {
+// Only used at compile time to build _midi_note_ocr below.
+static constexpr unsigned int _midi_note_frequencies[128] = {
 16,17,18,19,21,22,23,24,26,28,29,31,33,35,37,39,41,44,46,49,52,55,58,62,65,
 69,73,78,82,87,92,98,104,110,117,123,131,139,147,156,165,175,185,196,208,220,
 233,247,262,277,294,311,330,349,370,392,415,440,466,494,523,554,587,622,659,
@@ -43,6 +53,49 @@ const unsigned int PROGMEM _midi_note_frequencies[128] = {
 10548,11175,11840,12544,13290,14080,14917,15804,16744,17740,18795,19912,21096,
 22351,23680,25088 };
 
+// Timer compare values for each note at the configured F_CPU, so playNote()
+// does no division.  The 16 bit timers run at ck/1 where the compare value
+// fits, otherwise at ck/64.  The frequencies only go up, so every note
+// below _midi_note_fast uses ck/64.
+static constexpr uint32_t note_ocr_ck1(byte note)
+{
+  return F_CPU / _midi_note_frequencies[note] - 1;
+}
+
+static constexpr uint16_t note_ocr(byte note)
+{
+  return note_ocr_ck1(note) > 0xffff ?
+    F_CPU / _midi_note_frequencies[note] / 64 - 1 : note_ocr_ck1(note);
+}
+
+static constexpr byte note_first_fast(byte note)
+{
+  return (note < 127 && note_ocr_ck1(note) > 0xffff) ?
+    note_first_fast(note + 1) : note;
+}
+
+static constexpr byte _midi_note_fast = note_first_fast(0);
+
+#define NOTE_TABLE4(f, n)  f(n), f(n + 1), f(n + 2), f(n + 3)
+#define NOTE_TABLE16(f, n) NOTE_TABLE4(f, n), NOTE_TABLE4(f, n + 4), NOTE_TABLE4(f, n + 8), NOTE_TABLE4(f, n + 12)
+#define NOTE_TABLE(f) \
+  NOTE_TABLE16(f, 0),  NOTE_TABLE16(f, 16), NOTE_TABLE16(f, 32), NOTE_TABLE16(f, 48), \
+  NOTE_TABLE16(f, 64), NOTE_TABLE16(f, 80), NOTE_TABLE16(f, 96), NOTE_TABLE16(f, 112)
+
+#ifdef TUNES_SYNTH
+// Phase increment per sample for each note, for the software synth
+static constexpr uint16_t note_increment(byte note)
+{
+  return ((uint32_t)_midi_note_frequencies[note] * 32768UL + TUNES_SYNTH_RATE / 2) / TUNES_SYNTH_RATE;
+}
+
+const uint16_t PROGMEM _midi_note_increment[128] = { NOTE_TABLE(note_increment) };
+
+volatile TuneSynthVoice synth_voice[TUNES_SYNTH_VOICES];
+#else
+const uint16_t PROGMEM _midi_note_ocr[128] = { NOTE_TABLE(note_ocr) };
+#endif
+
 
 /* AUDIO */
 
@@ -81,6 +134,96 @@ void ArduboyAudio::tone(uint8_t channel, unsigned int frequency, unsigned long d
 
 /* TUNES */
 
+#ifdef TUNES_SYNTH
+// All the voices are mixed in software onto the first pin, which must be
+// OC1A.  Timer1 is an 8 bit fast PWM carrier (62.5kHz at 16MHz) and
+// Timer3 interrupts at TUNES_SYNTH_RATE to load it with the next sample,
+// but only while a voice is sounding, see synthClock().
+void ArduboyTunes::initChannel(byte pin) {
+  // the first pin takes every voice
+  if (_tune_num_chans)
+    return;
+
+  _tune_pins[0] = pin;
+  pinMode(pin, OUTPUT);
+  for (byte i = 0; i < TUNES_SYNTH_VOICES; i++) {
+    synth_voice[i].phase = 0xff00;  /* silent, see synthSample() */
+    synth_voice[i].increment = 0;
+    synth_voice[i].duty = 0x80;
+    score_note[i] = TUNE_NOTE_OFF;
+  }
+  _tune_num_chans = TUNES_SYNTH_VOICES;
+
+  TCCR1A = (1 << COM1A1) | (1 << WGM10);
+  TCCR1B = (1 << WGM12) | (1 << CS10);
+  OCR1A = 0;
+  TCCR3A = 0;
+  TCCR3B = (1 << WGM32) | (1 << CS30);
+  OCR3A = F_CPU / TUNES_SYNTH_RATE - 1;
+}
+
+// Run the sample interrupt while any voice has a note, and stop it when
+// they are all silent, so an idle synth does not wake the CPU
+// TUNES_SYNTH_RATE times a second.  The carrier is left at 0, low.
+void ArduboyTunes::synthClock() {
+  for (byte i = 0; i < TUNES_SYNTH_VOICES; i++) {
+    if (synth_voice[i].increment) {
+      bitWrite(TIMSK3, OCIE3A, 1);
+      return;
+    }
+  }
+  TIMSK3 &= ~(1 << OCIE3A);
+  OCR1A = 0;
+}
+
+void ArduboyTunes::playNote(byte chan, byte note) {
+  if (chan >= _tune_num_chans)
+    return;
+  if (note > 127)
+    note = 127;
+  synth_voice[chan].increment = pgm_read_word(_midi_note_increment + note);
+  synthClock();
+}
+
+void ArduboyTunes::stopNote(byte chan) {
+  if (chan >= _tune_num_chans)
+    return;
+  synth_voice[chan].increment = 0;
+  synth_voice[chan].phase = 0xff00;
+  synthClock();
+}
+
+// Set the duty cycle of a voice, out of 256.  0x80 is a square wave.
+void ArduboyTunes::setDuty(byte chan, byte duty) {
+  if (chan < TUNES_SYNTH_VOICES)
+    synth_voice[chan].duty = duty;
+}
+
+// Advance every voice by one sample and mix them into a PWM level.
+// A voice is high while the top byte of its phase is below its duty, so
+// a stopped voice parked at phase 0xff00 is always low.  Every voice is
+// mixed whether it is sounding or not, so the cost never changes.
+//
+// Estimated from the instruction counts (not measured): about 19 cycles
+// per voice plus about 40 of interrupt overhead, ~120 cycles with four
+// voices.  At 15.625kHz that is ~12% of a 16MHz CPU, whatever the notes,
+// and nothing while every voice is silent.
+// The toggle ISRs cost about 45 cycles per edge, which is two edges per
+// cycle of each note, so they get dearer as the pitch goes up.  They
+// break even with a synth voice at around 5kHz.
+uint8_t ArduboyTunes::synthSample()
+{
+  uint8_t sample = 0;
+  for (byte i = 0; i < TUNES_SYNTH_VOICES; i++) {
+    uint16_t phase = synth_voice[i].phase + synth_voice[i].increment;
+    synth_voice[i].phase = phase;
+    if ((uint8_t)(phase >> 8) < synth_voice[i].duty)
+      sample += TUNES_SYNTH_LEVEL;
+  }
+  return sample;
+}
+
+#else
 void ArduboyTunes::initChannel(byte pin) {
   byte timer_num;
 
@@ -90,6 +233,7 @@ void ArduboyTunes::initChannel(byte pin) {
 
   timer_num = pgm_read_byte(tune_pin_to_timer_PGM + _tune_num_chans);
   _tune_pins[_tune_num_chans] = pin;
+  score_note[_tune_num_chans] = TUNE_NOTE_OFF;
   _tune_num_chans++;
   pinMode(pin, OUTPUT);
   switch (timer_num) {
@@ -108,8 +252,6 @@ void ArduboyTunes::initChannel(byte pin) {
       bitWrite(TCCR3B, CS30, 1);
       _tunes_timer3_pin_port = portOutputRegister(digitalPinToPort(pin));
       _tunes_timer3_pin_mask = digitalPinToBitMask(pin);
-      playNote(0, 60);  /* start and stop channel 0 (timer 3) on middle C so wait/delay works */
-      stopNote(0);
       break;
   }
 }
@@ -118,8 +260,7 @@ void ArduboyTunes::initChannel(byte pin) {
 void ArduboyTunes::playNote(byte chan, byte note) {
   byte timer_num;
   byte prescalar_bits;
-  unsigned int frequency2; /* frequency times 2 */
-  unsigned long ocr;
+  unsigned int ocr;
 
   // we can't plan on a channel that does not exist
   if (chan >= _tune_num_chans)
@@ -130,29 +271,31 @@ void ArduboyTunes::playNote(byte chan, byte note) {
     note = 127;
 
   timer_num = pgm_read_byte(tune_pin_to_timer_PGM + chan);
-  frequency2 = pgm_read_word(_midi_note_frequencies + note);
+  ocr = pgm_read_word(_midi_note_ocr + note);
 
   //******  16-bit timer  *********
   // two choices for the 16 bit timers: ck/1 or ck/64
-  ocr = F_CPU / frequency2 - 1;
-  prescalar_bits = 0b001;
-  if (ocr > 0xffff) {
-    ocr = F_CPU / frequency2 / 64 - 1;
-    prescalar_bits = 0b011;
-  }
+  prescalar_bits = note < _midi_note_fast ? 0b011 : 0b001;
   // Set the OCR for the given timer, then turn on the interrupts
   switch (timer_num) {
     case 1:
       TCCR1B = (TCCR1B & 0b11111000) | prescalar_bits;
       OCR1A = ocr;
+#ifdef TUNES_HW_TOGGLE
+      bitWrite(TCCR1A, COM1A0, 1);  // the timer toggles OC1A itself
+#else
       bitWrite(TIMSK1, OCIE1A, 1);
+#endif
       break;
     case 3:
       TCCR3B = (TCCR3B & 0b11111000) | prescalar_bits;
       OCR3A = ocr;
-      wait_timer_frequency2 = frequency2;  // for "tune_delay" function
       wait_timer_playing = true;
+#ifdef TUNES_HW_TOGGLE
+      bitWrite(TCCR3A, COM3A0, 1);  // the timer toggles OC3A itself
+#else
       bitWrite(TIMSK3, OCIE3A, 1);
+#endif
       break;
   }
 }
@@ -162,182 +305,390 @@ void ArduboyTunes::stopNote(byte chan) {
   timer_num = pgm_read_byte(tune_pin_to_timer_PGM + chan);
   switch (timer_num) {
     case 1:
+#ifdef TUNES_HW_TOGGLE
+      TCCR1A &= ~(1 << COM1A0);                 // hand the pin back to PORTB
+#else
       TIMSK1 &= ~(1 << OCIE1A);                 // disable the interrupt
+#endif
       *_tunes_timer1_pin_port &= ~(_tunes_timer1_pin_mask);   // keep pin low after stop
       break;
     case 3:
       wait_timer_playing = false;
+#ifdef TUNES_HW_TOGGLE
+      TCCR3A &= ~(1 << COM3A0);                 // hand the pin back to PORTC
+#else
+      TIMSK3 &= ~(1 << OCIE3A);                 // disable the interrupt
+#endif
       *_tunes_timer3_pin_port &= ~(_tunes_timer3_pin_mask);   // keep pin low after stop
       break;
   }
 }
 
-void ArduboyTunes::playScore(const byte *score) {
-  score_start = score;
-  score_cursor = score_start;
-  step();  /* execute initial commands */
-  tune_playing = true;  /* release the interrupt routine */
+#endif
+
+// Is an effect, or a tone(), sounding on this channel?
+bool ArduboyTunes::effectHas(byte chan) {
+  return effectPlaying && chan == _tune_num_chans - 1;
+}
+
+bool ArduboyTunes::toneHas(byte chan) {
+  return tonePlaying && chan == TUNES_TONE_CHANNEL;
 }
 
-void ArduboyTunes::playEffect(const byte *effect) {
-  effect_start = effect;
-  effect_cursor = effect_start;
+// Score notes go through these so that a channel an effect or a tone()
+// is using only records what the score wants, to be restored when they
+// end.
+void ArduboyTunes::scoreNote(byte chan, byte note) {
+  if (chan >= _tune_num_chans)
+    return;
+  if (note > 127)
+    note = 127;
+  score_note[chan] = note;
+  if (!effectHas(chan) && !toneHas(chan))
+    playNote(chan, note);
+}
 
-  step();  /* execute initial commands */
+void ArduboyTunes::scoreStop(byte chan) {
+  if (chan >= _tune_num_chans)
+    return;
+  score_note[chan] = TUNE_NOTE_OFF;
+  if (!effectHas(chan) && !toneHas(chan))
+    stopNote(chan);
+}
+
+// Give a channel back to whatever is under what just ended on it: a
+// tone() still running, or the score.
+void ArduboyTunes::restoreChannel(byte chan) {
+  if (toneHas(chan))
+    soundTone();
+  else if (chan < _tune_num_chans && score_note[chan] != TUNE_NOTE_OFF)
+    playNote(chan, score_note[chan]);
+  else
+    stopNote(chan);
+}
+
+// Wait for a free slot in the queue.  The tick empties the queue once
+// a millisecond, so this only spins when commands are sent in a burst.
+// Returns 0 when there are no channels to play anything on.
+volatile TuneCommand *ArduboyTunes::queueSlot() {
+  byte head = tune_queue_head;
+  if (_tune_num_chans == 0)
+    return 0;
+  while ((byte)(head - tune_queue_tail) == TUNE_QUEUE_SIZE)
+    ;
+  return &tune_queue[head & (TUNE_QUEUE_SIZE - 1)];
+}
+
+// Hand the slot filled in since queueSlot() over to the tick.
+void ArduboyTunes::queuePush() {
+  tune_queue_head++;
+}
+
+// Queue a score or effect along with the step function for its storage.
+void ArduboyTunes::queueScore(byte op, const byte *score, TuneStep step) {
+  volatile TuneCommand *cmd = queueSlot();
+  if (!cmd)
+    return;
+  cmd->op = op;
+  cmd->step = step;
+  cmd->score = score;
+  queuePush();
 }
 
 void ArduboyTunes::stopScore (void) {
-  for (uint8_t i = 0; i < _tune_num_chans; i++)
-    stopNote(i);
-  tune_playing = false;
+  volatile TuneCommand *cmd = queueSlot();
+  if (!cmd)
+    return;
+  cmd->op = TUNE_CMD_STOP_SCORE;
+  queuePush();
 }
 
+// Commands still in the queue count as playing, so a score started just
+// now is reported before the tick has picked it up.
 bool ArduboyTunes::playing()
 {
-  return tune_playing;
+  return tune_playing || tune_queue_head != tune_queue_tail;
 }
 
 
-/* Do score commands until a "wait" is found, or the score is stopped.
-This is called initially from tune_playcore, but then is called
-from the interrupt routine when waits expire.
+/* Do commands for a voice until a "wait" is found, or it is stopped.
+Returns false once the voice has stopped.  An effect always sounds on
+the last channel, whatever channel its commands name.  There is one of
+these for each score storage, so reading a byte costs no more than it
+would for a single kind of storage.
 */
 /* if CMD < 0x80, then the other 7 bits and the next byte are a 15-bit big-endian number of msec to wait */
-void ArduboyTunes::step() {
+template <class Storage>
+bool ArduboyTunes::stepVoice(volatile TuneVoice *voice, bool effect) {
   byte command, opcode, chan;
   unsigned duration;
 
   while (1) {
-    command = pgm_read_byte(score_cursor++);
+    command = Storage::read(voice->cursor++);
     opcode = command & 0xf0;
-    chan = command & 0x0f;
+    chan = effect ? _tune_num_chans - 1 : command & 0x0f;
     if (opcode == TUNE_OP_STOPNOTE) { /* stop note */
-      stopNote(chan);
+      if (effect) stopNote(chan);
+      else scoreStop(chan);
     }
     else if (opcode == TUNE_OP_PLAYNOTE) { /* play note */
-      playNote(chan, pgm_read_byte(score_cursor++));
+      if (effect) playNote(chan, Storage::read(voice->cursor++));
+      else scoreNote(chan, Storage::read(voice->cursor++));
     }
     else if (opcode == TUNE_OP_RESTART) { /* restart score */
-      score_cursor = score_start;
+      voice->cursor = voice->start;
     }
     else if (opcode == TUNE_OP_STOP) { /* stop score */
-      tune_playing = false;
-      break;
+      return false;
     }
     else if (opcode < 0x80) { /* wait count in msec. */
-      duration = ((unsigned)command << 8) | (pgm_read_byte(score_cursor++));
-      wait_toggle_count = ((unsigned long) wait_timer_frequency2 * duration + 500) / 1000;
-      if (wait_toggle_count == 0) wait_toggle_count = 1;
-      break;
+      duration = ((unsigned)command << 8) | (Storage::read(voice->cursor++));
+      voice->wait_ms = duration;  /* counted down in ms by tick() */
+      if (voice->wait_ms == 0) voice->wait_ms = 1;
+      return true;
     }
   }
 }
 
+template bool ArduboyTunes::stepVoice<TunesProgmem>(volatile TuneVoice *voice, bool effect);
+template bool ArduboyTunes::stepVoice<TunesSram>(volatile TuneVoice *voice, bool effect);
+template bool ArduboyTunes::stepVoice<TunesEeprom>(volatile TuneVoice *voice, bool effect);
+
+/* Called from the sequencer tick when a score wait expires. */
+void ArduboyTunes::step() {
+  if (!score_voice.step(&score_voice, false))
+    tune_playing = false;
+}
+
+/* Advance the effect voice, giving the channel back to a tone() or the
+score when it is done.
+*/
+void ArduboyTunes::stepEffect() {
+  if (effect_voice.step(&effect_voice, true))
+    return;
+  effectPlaying = false;
+  restoreChannel(_tune_num_chans - 1);
+}
+
+/* Carry out one command from the sketch, from the sequencer tick. */
+void ArduboyTunes::runCommand(volatile TuneCommand *cmd) {
+  // only delays still mean anything once the channels are closed
+  if (_tune_num_chans == 0 && cmd->op != TUNE_CMD_DELAY)
+    return;
+  switch (cmd->op) {
+    case TUNE_CMD_PLAY_SCORE:
+      score_voice.start = cmd->score;
+      score_voice.cursor = cmd->score;
+      score_voice.step = cmd->step;
+      tune_playing = score_voice.step(&score_voice, false);  /* execute initial commands */
+      break;
+    case TUNE_CMD_STOP_SCORE:
+      tune_playing = false;
+      for (uint8_t i = 0; i < _tune_num_chans; i++)
+        scoreStop(i);
+      break;
+    case TUNE_CMD_PLAY_EFFECT:
+      effect_voice.start = cmd->score;
+      effect_voice.cursor = cmd->score;
+      effect_voice.step = cmd->step;
+      effectPlaying = true;
+      stepEffect();
+      break;
+    case TUNE_CMD_TONE:
+      startTone(cmd->value, cmd->bits, cmd->duration);
+      break;
+    case TUNE_CMD_DELAY:
+      delay_ms_count = cmd->value;
+      if (delay_ms_count == 0)
+        delay_waiting = false;
+      break;
+  }
+}
+
+// Start timing a delay on the sequencer tick; poll delayDone() for the end.
+void ArduboyTunes::startDelay (unsigned duration) {
+  volatile TuneCommand *cmd = queueSlot();
+
+  if (!cmd) {  // no sequencer tick to count it
+    ::delay(duration);
+    return;
+  }
+  delay_waiting = true;
+  cmd->op = TUNE_CMD_DELAY;
+  cmd->value = duration;
+  queuePush();
+}
+
+bool ArduboyTunes::delayDone () {
+  return !delay_waiting;  // the tick clears it when the delay runs out
+}
+
+// Sleep through a delay.  Timer0 wakes the CPU every millisecond, the
+// same as Arduboy::idle() relies on.
 void ArduboyTunes::delay (unsigned duration) {
-  boolean notdone;
-  noInterrupts();
-  delay_toggle_count = ((unsigned long) wait_timer_frequency2 * duration + 500) / 1000;
-  doing_delay = true;
-  interrupts();
-  do { // wait until the interrupt routines decrements the toggle count to zero
-    noInterrupts();
-    notdone = delay_toggle_count != 0;  /* interrupt-safe test */
-    interrupts();
+  startDelay(duration);
+  while (!delayDone()) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
   }
-  while (notdone);
-  doing_delay = false;
 }
 
+// The sequencer tick plays notes too, so it is held off until every
+// channel is closed.  Otherwise a note it starts half way through would
+// turn a timer back on and sound, and wake the CPU, until reopened.
+#ifdef TUNES_SYNTH
+void ArduboyTunes::closeChannels(void) {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (_tune_num_chans) {
+    TIMSK3 &= ~(1 << OCIE3A);
+    TCCR1A = 0;                   // hand the pin back to PORTB
+    digitalWrite(_tune_pins[0], 0);
+  }
+  _tune_num_chans = 0;
+  tune_playing = false;
+  effectPlaying = false;
+  tonePlaying = false;
+  SREG = oldSREG;
+}
+#else
 void ArduboyTunes::closeChannels(void) {
   byte timer_num;
+  uint8_t oldSREG = SREG;
+  cli();
   for (uint8_t chan=0; chan < _tune_num_chans; chan++) {
     timer_num = pgm_read_byte(tune_pin_to_timer_PGM + chan);
     switch (timer_num) {
       case 1:
         TIMSK1 &= ~(1 << OCIE1A);
+        TCCR1A &= ~(1 << COM1A0);
         break;
       case 3:
         TIMSK3 &= ~(1 << OCIE3A);
+        TCCR3A &= ~(1 << COM3A0);
         break;
     }
     digitalWrite(_tune_pins[chan], 0);
   }
   _tune_num_chans = 0;
   tune_playing = false;
+  effectPlaying = false;
+  tonePlaying = false;
+  SREG = oldSREG;
 }
+#endif
 
+// Timer 3 interrupt, toggles the channel 0 pin at the note frequency.
+// All timing is done by tick(), so this is the only work done per toggle.
 void ArduboyTunes::soundOutput()
 {
-  if (wait_timer_playing) { // toggle the pin if we're sounding a note
-    *_tunes_timer3_pin_port ^= _tunes_timer3_pin_mask;
-  }
-  if (tune_playing && wait_toggle_count && --wait_toggle_count == 0) {
-    // end of a score wait, so execute more score commands
-    wait_timer_old_frequency2 = wait_timer_frequency2;  // save this timer's frequency
-    ArduboyTunes::step();  // execute commands
-    // If this timer's frequency has changed and we're using it for a tune_delay(),
-    // recompute the number of toggles to wait for
-    if (doing_delay && wait_timer_old_frequency2 != wait_timer_frequency2) {
-      if (delay_toggle_count >= 0x20000UL && wait_timer_frequency2 >= 0x4000U) {
-        // Need to avoid 32-bit overflow...
-        delay_toggle_count = ( (delay_toggle_count+4>>3) * (wait_timer_frequency2+2>>2) / wait_timer_old_frequency2 )<<5;
-      }
-      else {
-        delay_toggle_count = delay_toggle_count * wait_timer_frequency2 / wait_timer_old_frequency2;
-      }
-    }
-  }
-  if (doing_delay && delay_toggle_count) --delay_toggle_count;  // countdown for tune_delay()
+  *_tunes_timer3_pin_port ^= _tunes_timer3_pin_mask;
 }
-void ArduboyTunes::tone(unsigned int frequency, unsigned long duration) {
-  tonePlaying = true;
-  uint8_t prescalarbits = 0b001;
-  int32_t toggle_count = 0;
-  uint32_t ocr = 0;
 
-  // two choices for the 16 bit timers: ck/1 or ck/64
-  ocr = F_CPU / frequency / 2 - 1;
-  prescalarbits = 0b001;
+// tone() with a frequency only known at run time
+void ArduboyTunes::toneFrequency(unsigned int frequency, unsigned long duration)
+{
+#ifdef TUNES_SYNTH
+  toneOCR(tune_synth_increment(frequency), 0, duration);
+#else
+  uint32_t ocr = tune_tone_ocr_ck1(frequency);
   if (ocr > 0xffff) {
-    ocr = F_CPU / frequency / 2 / 64 - 1;
-    prescalarbits = 0b011;
+    toneOCR((ocr + 1) / 64 - 1, 0b011, duration);
   }
-  TCCR1B = (TCCR1B & 0b11111000) | prescalarbits;
+  else {
+    toneOCR(ocr, 0b001, duration);
+  }
+#endif
+}
+
+void ArduboyTunes::toneOCR(uint16_t ocr, uint8_t prescalarbits, unsigned long duration)
+{
+  volatile TuneCommand *cmd = queueSlot();
+  if (!cmd)
+    return;
+  cmd->op = TUNE_CMD_TONE;
+  cmd->bits = prescalarbits;
+  cmd->value = ocr;
+  cmd->duration = duration;
+  queuePush();
+}
+
+// Start a tone on Timer1, from the sequencer tick.  The synth plays it on
+// the last voice instead, and ocr is that voice's phase increment.  While
+// an effect has the channel the tone is timed but not heard.
+void ArduboyTunes::startTone(uint16_t ocr, uint8_t prescalarbits, unsigned long duration)
+{
+  tone_ocr = ocr;
+  tone_bits = prescalarbits;
+  tonePlaying = true;
 
-  // Calculate the toggle count
+  // the duration is counted down in ms by tick()
   if (duration > 0) {
-    toggle_count = 2 * frequency * duration / 1000;
+    tone_ms_count = duration;
   }
   else {
-    toggle_count = -1;
+    tone_ms_count = -1;
   }
-  // Set the OCR for the given timer,
-  // set the toggle count,
-  // then turn on the interrupts
-  OCR1A = ocr;
-  timer1_toggle_count = toggle_count;
+  if (!effectHas(TUNES_TONE_CHANNEL))
+    soundTone();
+}
+
+// Set the OCR for the tone's timer, then turn on the output
+void ArduboyTunes::soundTone()
+{
+#ifdef TUNES_SYNTH
+  synth_voice[TUNES_TONE_CHANNEL].increment = tone_ocr;
+  synthClock();
+#else
+  TCCR1B = (TCCR1B & 0b11111000) | tone_bits;
+  OCR1A = tone_ocr;
+#ifdef TUNES_HW_TOGGLE
+  bitWrite(TCCR1A, COM1A0, 1);
+#else
   bitWrite(TIMSK1, OCIE1A, 1);
+#endif
+#endif
 }
 
-ISR(TIMER1_COMPA_vect) {  // TIMER 1
-  if (tonePlaying) {
-    if (timer1_toggle_count != 0) {
-      // toggle the pin
-      *_tunes_timer1_pin_port ^= _tunes_timer1_pin_mask;
-      if (timer1_toggle_count > 0) timer1_toggle_count--;
+// Fixed rate sequencer tick, independent of whatever note is sounding.
+// Runs any queued commands, then counts score waits, delays and tone
+// durations in whole milliseconds.  The tick period is collected in a microsecond
+// accumulator so tempo stays exact without any division.
+void ArduboyTunes::tick()
+{
+  byte tail = tune_queue_tail;
+  while (tail != tune_queue_head) {
+    runCommand(&tune_queue[tail & (TUNE_QUEUE_SIZE - 1)]);
+    tune_queue_tail = ++tail;
+  }
+
+  tick_us += TUNES_TICK_US;
+  while (tick_us >= 1000) {
+    tick_us -= 1000;
+    if (tune_playing && score_voice.wait_ms && --score_voice.wait_ms == 0) {
+      ArduboyTunes::step();
+    }
+    if (effectPlaying && --effect_voice.wait_ms == 0) {
+      ArduboyTunes::stepEffect();
     }
-    else {
+    if (delay_ms_count && --delay_ms_count == 0) delay_waiting = false;
+    if (tonePlaying && tone_ms_count > 0 && --tone_ms_count == 0) {
       tonePlaying = false;
-      TIMSK1 &= ~(1 << OCIE1A);                 // disable the interrupt
-      *_tunes_timer1_pin_port &= ~(_tunes_timer1_pin_mask);   // keep pin low after stop
+      if (!effectHas(TUNES_TONE_CHANNEL))
+        restoreChannel(TUNES_TONE_CHANNEL);
     }
   }
-  else {
-    *_tunes_timer1_pin_port ^= _tunes_timer1_pin_mask;  // toggle the pin
-  }
+}
+
+#if defined(TUNES_SYNTH)
+ISR(TIMER3_COMPA_vect) {  // synth sample clock
+  OCR1A = ArduboyTunes::synthSample();
+}
+#elif !defined(TUNES_HW_TOGGLE)
+ISR(TIMER1_COMPA_vect) {  // TIMER 1
+  *_tunes_timer1_pin_port ^= _tunes_timer1_pin_mask;  // toggle the pin
 }
 ISR(TIMER3_COMPA_vect) {  // TIMER 3
-  // Timer 3 is the one assigned first, so we keep it running always
-  // and use it to time score waits, whether or not it is playing a note.
   ArduboyTunes::soundOutput();
 }
+#endif
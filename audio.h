@@ -4,13 +4,142 @@
 #include <Arduino.h>
 #include <EEPROM.h>
 #include <avr/pgmspace.h>
+#include <avr/eeprom.h>
 #include <avr/power.h>
+#include <avr/sleep.h>
 
 #define AVAILABLE_TIMERS 2
+
+// Uncomment to have Timer3 and Timer1 toggle the speaker pins themselves
+// (compare output toggle mode) instead of an interrupt every half period.
+// The speaker must then be wired to OC3A (pin 5) and OC1A (pin 9), which
+// the DEVKIT uses for buttons.
+// #define TUNES_HW_TOGGLE
+
+// Uncomment to mix TUNES_SYNTH_VOICES square wave voices in software and
+// play them as PWM on OC1A (pin 9, a button on the DEVKIT), instead of
+// one timer per voice.  Each voice has its own duty cycle, see setDuty().
+// The cost of the mixing interrupt is fixed, see synthSample().
+// #define TUNES_SYNTH
+#define TUNES_SYNTH_VOICES 4
+#define TUNES_SYNTH_RATE 15625UL	/* samples per second */
+#define TUNES_SYNTH_LEVEL (255 / TUNES_SYNTH_VOICES)
+
+#if defined(TUNES_SYNTH) && defined(TUNES_HW_TOGGLE)
+#error "TUNES_SYNTH and TUNES_HW_TOGGLE both drive the speaker timers"
+#endif
+
+#ifdef TUNES_SYNTH
+#define TUNES_CHANNELS TUNES_SYNTH_VOICES
+#else
+#define TUNES_CHANNELS AVAILABLE_TIMERS
+#endif
+
+// tone() sounds on Timer1, or the last synth voice, which is also the
+// channel effects take.  An effect has it before tone(), and tone()
+// before the score; whatever it was taken from carries on silently and
+// is heard again when the effect or tone ends.
+#define TUNES_TONE_CHANNEL (TUNES_CHANNELS - 1)
+
+// The sequencer tick is called from the system tick in Arduboy.cpp, Timer0
+// compare A, which fires once per Timer0 cycle (64 * 256 clocks, ~1kHz at
+// 16MHz) alongside the millis() overflow.
+// Score waits, delays and tone durations are all timed by it, so tempo
+// does not depend on the note currently sounding on Timer3.  Divided by
+// clocks per us, 64 * 256 * 1000000 would overflow 32 bits.
+#define TUNES_TICK_US ((64UL * 256UL) / (F_CPU / 1000000UL))
 #define TUNE_OP_PLAYNOTE	0x90	/* play a note: low nibble is generator #, note is next byte */
 #define TUNE_OP_STOPNOTE	0x80	/* stop a note: low nibble is generator # */
 #define TUNE_OP_RESTART	0xe0	/* restart the score from the beginning */
 #define TUNE_OP_STOP	0xf0	/* stop playing */
+#define TUNE_NOTE_OFF	0x80	/* no note sounding on a channel */
+
+// Commands queued by the sketch for the sequencer tick.  The queue size
+// must be a power of two; the sketch waits for a slot when it is full.
+#define TUNE_QUEUE_SIZE	4
+#define TUNE_CMD_PLAY_SCORE	1	/* score: start playing a score */
+#define TUNE_CMD_STOP_SCORE	2	/* stop the score */
+#define TUNE_CMD_PLAY_EFFECT	3	/* score: start playing an effect */
+#define TUNE_CMD_TONE	4	/* value, bits: Timer1 compare and prescaler */
+#define TUNE_CMD_DELAY	5	/* value: ms until delay_waiting is cleared */
+
+struct TuneVoice;
+typedef bool (*TuneStep)(volatile TuneVoice *voice, bool effect);
+
+struct TuneCommand
+{
+	byte op;
+	byte bits;
+	union {
+		unsigned value;
+		TuneStep step;		// for scores and effects
+	};
+	union {
+		const byte *score;
+		unsigned long duration;
+	};
+};
+
+// A score or effect being played by the sequencer tick
+struct TuneVoice
+{
+	const byte *start;		// beginning, for TUNE_OP_RESTART
+	const byte *cursor;		// next command
+	unsigned wait_ms;		// ms left of the current wait
+	TuneStep step;			// reads commands from where the score is kept
+};
+
+// Where a score is kept, for playScore() and playEffect().  A score in
+// SRAM must stay there until it has finished.  A score in EEPROM is read
+// from the sequencer tick, which stalls while an EEPROM write finishes.
+struct TunesProgmem
+{
+	static byte read(const byte *p) { return pgm_read_byte(p); }
+};
+
+struct TunesSram
+{
+	static byte read(const byte *p) { return *p; }
+};
+
+struct TunesEeprom
+{
+	static byte read(const byte *p) { return eeprom_read_byte(p); }
+};
+
+// Timer1 compare value for a tone() frequency, at ck/1 and at ck/64
+constexpr uint32_t tune_tone_ocr_ck1(unsigned int frequency)
+{
+	return F_CPU / 2 / frequency - 1;
+}
+
+constexpr uint16_t tune_tone_ocr(unsigned int frequency)
+{
+	return tune_tone_ocr_ck1(frequency) > 0xffff ?
+		F_CPU / 2 / 64 / frequency - 1 : tune_tone_ocr_ck1(frequency);
+}
+
+constexpr uint8_t tune_tone_prescaler(unsigned int frequency)
+{
+	return tune_tone_ocr_ck1(frequency) > 0xffff ? 0b011 : 0b001;
+}
+
+// Synth phase increment per sample for a frequency.  Anything above half
+// the sample rate would only alias, and the increment would overflow 16
+// bits from the sample rate up, so it is held at half the sample rate.
+constexpr uint16_t tune_synth_increment(unsigned int frequency)
+{
+	return frequency > TUNES_SYNTH_RATE / 2 ? 0x8000 :
+		((uint32_t)frequency * 65536UL + TUNES_SYNTH_RATE / 2) / TUNES_SYNTH_RATE;
+}
+
+// One software synth voice
+struct TuneSynthVoice
+{
+	uint16_t phase;			// top byte is the position in the cycle
+	uint16_t increment;		// added to phase every sample
+	uint8_t duty;			// high while the phase is below this
+};
 
 
 class ArduboyAudio
@@ -33,23 +162,76 @@ class ArduboyTunes
 public:
 	// Playtune Functions
 	void initChannel(byte pin);			// assign a timer to an output pin
-	void playScore(const byte *score);	// start playing a polyphonic score
-        void playEffect(const byte *effect);    // plays a short music effect pauses score and resumes once finished
+	// start playing a polyphonic score
+	template <class Storage = TunesProgmem>
+	void playScore(const byte *score)
+	{
+		queueScore(TUNE_CMD_PLAY_SCORE, score, &stepVoice<Storage>);
+	}
+	// play a short effect on the last channel, then give it back to a
+	// tone() or the score
+	template <class Storage = TunesProgmem>
+	void playEffect(const byte *effect)
+	{
+		queueScore(TUNE_CMD_PLAY_EFFECT, effect, &stepVoice<Storage>);
+	}
 	void stopScore();			// stop playing the score
-	void delay(unsigned msec);		// delay in milliseconds
+	void delay(unsigned msec);		// delay in milliseconds, asleep
+	void startDelay(unsigned msec);		// start a delay and return at once
+	bool delayDone();			// has the last delay run out?
 	void closeChannels();			// stop all timers
 	bool playing();
 
-    void tone(unsigned int frequency, unsigned long duration);
+	// constant frequencies are turned into compare values at compile time
+	inline __attribute__((always_inline))
+	void tone(unsigned int frequency, unsigned long duration)
+	{
+#ifdef TUNES_SYNTH
+		if (__builtin_constant_p(frequency))
+			toneOCR(tune_synth_increment(frequency), 0, duration);
+		else
+#else
+		if (__builtin_constant_p(frequency))
+			toneOCR(tune_tone_ocr(frequency), tune_tone_prescaler(frequency), duration);
+		else
+#endif
+			toneFrequency(frequency, duration);
+	}
+	void toneFrequency(unsigned int frequency, unsigned long duration);
+	void static toneOCR(uint16_t ocr, uint8_t prescalarbits, unsigned long duration);
+#ifdef TUNES_SYNTH
+	void setDuty(byte chan, byte duty);	// duty cycle of a voice, 0x80 is square
+#endif
 
 	// called via interrupt
 	void static step();
+	void static stepEffect();
+	void static runCommand(volatile TuneCommand *cmd);
 	void static soundOutput();
+	void static tick();
+#ifdef TUNES_SYNTH
+	uint8_t static synthSample();
+#endif
 
 
 private:
 	void static playNote (byte chan, byte note);
 	void static stopNote (byte chan);
+	void static scoreNote (byte chan, byte note);
+	void static scoreStop (byte chan);
+	template <class Storage>
+	bool static stepVoice (volatile TuneVoice *voice, bool effect);
+	void static queueScore (byte op, const byte *score, TuneStep step);
+	void static startTone (uint16_t ocr, uint8_t prescalarbits, unsigned long duration);
+	void static soundTone ();
+	bool static effectHas (byte chan);
+	bool static toneHas (byte chan);
+	void static restoreChannel (byte chan);
+#ifdef TUNES_SYNTH
+	void static synthClock ();
+#endif
+	static volatile TuneCommand *queueSlot ();
+	void static queuePush ();
 
 
 };
@@ -0,0 +1,20 @@
+#ifndef EEPROM_h
+#define EEPROM_h
+
+// Host stand-in for the EEPROM library, over ArduboyHost::eeprom
+
+#include <Arduino.h>
+#include <avr/eeprom.h>
+
+class EEPROMClass
+{
+public:
+  uint8_t read(int idx) { return eeprom_read_byte((const uint8_t *)(uintptr_t)idx); }
+  void write(int idx, uint8_t val) { eeprom_write_byte((uint8_t *)(uintptr_t)idx, val); }
+  void update(int idx, uint8_t val) { eeprom_update_byte((uint8_t *)(uintptr_t)idx, val); }
+  uint16_t length() { return E2END + 1; }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef HardwareSerial_h
+#define HardwareSerial_h
+
+// Host stand-in for the USB Serial.  What the sketch reads comes from
+// ArduboyHost::serialIn and what it writes goes to ArduboyHost::serialOut.
+
+class HostSerial : public Print
+{
+public:
+  void begin(unsigned long) { }
+  void end() { }
+  int available();
+  int peek();
+  int read();
+  void flush() { }
+  virtual size_t write(uint8_t);
+  using Print::write;
+  operator bool() { return true; }
+};
+
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef SPI_h
+#define SPI_h
+
+// Host stand-in for the SPI library.  Every byte is handed to the panel
+// in host.cpp, which keeps the stream and what an SSD1306 would show.
+
+#include <Arduino.h>
+
+#define SPI_CLOCK_DIV2 0x04
+#define SPI_MODE0 0x00
+#define MSBFIRST 1
+
+class SPIClass
+{
+public:
+  static void begin() { }
+  static void end() { }
+  static void setClockDivider(uint8_t) { }
+  static void setDataMode(uint8_t) { }
+  static void setBitOrder(uint8_t) { }
+  static uint8_t transfer(uint8_t data);
+};
+
+extern SPIClass SPI;
+
+#endif
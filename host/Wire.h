@@ -0,0 +1,6 @@
+#ifndef TwoWire_h
+#define TwoWire_h
+
+// The sketch includes Wire.h but never uses it
+
+#endif
@@ -0,0 +1,238 @@
+/*********************************************************
+ *                                                       *
+ *                   ARDUSKETCH-BENCH                    *
+ *                                                       *
+ *   Times every drawing primitive and screen renderer   *
+ *   of the Arduboy library on the host, over the cases  *
+ *   in bench.cpp, and writes the results as JSON.       *
+ *   bench-avr.cpp runs the same cases on the device or  *
+ *   in simavr and counts cycles instead.                *
+ *                                                       *
+ *   Results from two commits, host or device, can be    *
+ *   compared to catch a primitive getting slower.       *
+ *                                                       *
+ *  Build: make -C host ardusketch-bench                 *
+ *********************************************************/
+
+/*
+ Usage:
+   ardusketch-bench [--commit ID] [--samples N] [--filter NAME] [--out FILE]
+                    [--baseline FILE] [--threshold PCT]
+   ardusketch-bench --compare OLD.json NEW.json [--threshold PCT]
+
+ Each case is run until a sample takes at least 2 ms, and the fastest of
+ --samples samples (default 11) is reported as ns per shape.
+ The SPI stand-in keeps no stream here, but its SSD1306 model still runs,
+ so display() and the screen renderers are slower than they need be.
+
+ With --baseline, or --compare, a case more than --threshold percent
+ (default 10) slower than before is marked and the exit status is 1.
+ On a busy machine host times move by that much from run to run, so raise
+ it there; cycle counts from bench-avr do not move at all.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "host.h"
+
+Arduboy arduboy;
+
+// Print to a stdio stream, for the shared JSON writer
+class FilePrint : public Print
+{
+public:
+  FilePrint(FILE *f) : f(f) { }
+  virtual size_t write(uint8_t c) { return fputc(c, f) == EOF ? 0 : 1; }
+  using Print::write;
+
+private:
+  FILE *f;
+};
+
+static void usage()
+{
+  fprintf(stderr, "usage: ardusketch-bench [--commit ID] [--samples N] [--filter NAME] [--out FILE]\n"
+                  "                        [--baseline FILE] [--threshold PCT]\n"
+                  "       ardusketch-bench --compare OLD.json NEW.json [--threshold PCT]\n");
+  exit(2);
+}
+
+static double nowNs()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// ns per shape for one case
+static double timeCase(const BenchCase &c, const BenchOp *ops, int samples)
+{
+  unsigned long reps = 1;
+  std::vector<double> per_op;
+
+  // enough runs that a sample is well above the clock's resolution
+  for (;;) {
+    double start = nowNs();
+    for (unsigned long r = 0; r < reps; r++)
+      benchRun(arduboy, c, ops);
+    if (nowNs() - start >= 2e6 || reps >= (1UL << 24))
+      break;
+    reps *= 2;
+  }
+  for (int s = 0; s < samples; s++) {
+    double start = nowNs();
+    for (unsigned long r = 0; r < reps; r++)
+      benchRun(arduboy, c, ops);
+    per_op.push_back((nowNs() - start) / (reps * BENCH_OPS));
+  }
+  // the fastest sample is the one least disturbed by the rest of the system
+  return *std::min_element(per_op.begin(), per_op.end());
+}
+
+/**********************************
+ * Comparing Results              *
+ **********************************/
+
+typedef std::map<std::string, double> Results;   // "name variant" to per_op
+
+// pull the results out of a file written by benchResult(), a line each
+static bool readResults(const char *path, Results &results, std::string &unit)
+{
+  FILE *f = fopen(path, "r");
+  char line[512];
+
+  if (!f)
+    return false;
+  while (fgets(line, sizeof(line), f)) {
+    char name[64], variant[64];
+    double value;
+    const char *u = strstr(line, "\"unit\": \"");
+    if (u)
+      unit = std::string(u + 9, strcspn(u + 9, "\""));
+    const char *r = strstr(line, "{\"name\": \"");
+    if (r && sscanf(r, "{\"name\": \"%63[^\"]\", \"variant\": \"%63[^\"]\", \"per_op\": %lf",
+                    name, variant, &value) == 3)
+      results[std::string(name) + " " + variant] = value;
+  }
+  fclose(f);
+  return true;
+}
+
+// returns the number of cases more than threshold percent slower
+static int compare(const Results &old_results, const Results &new_results,
+                   const std::string &unit, double threshold)
+{
+  int slower = 0;
+
+  fprintf(stderr, "%-30s %12s %12s %8s\n", "case", ("old " + unit).c_str(),
+          ("new " + unit).c_str(), "change");
+  for (const auto &r : new_results) {
+    auto old = old_results.find(r.first);
+    if (old == old_results.end()) {
+      fprintf(stderr, "%-30s %12s %12.2f %8s\n", r.first.c_str(), "-", r.second, "new");
+      continue;
+    }
+    double change = old->second ? (r.second - old->second) * 100 / old->second : 0;
+    bool worse = change > threshold;
+    fprintf(stderr, "%-30s %12.2f %12.2f %+7.1f%%%s\n", r.first.c_str(), old->second,
+            r.second, change, worse ? "  slower" : "");
+    slower += worse;
+  }
+  return slower;
+}
+
+int main(int argc, char **argv)
+{
+  const char *commit = "unknown", *filter = NULL, *out_path = NULL, *baseline = NULL;
+  const char *compare_old = NULL, *compare_new = NULL;
+  int samples = 11;
+  double threshold = 10;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) usage();
+    const char *value = argv[++i];
+
+    if (arg == "--commit") commit = value;
+    else if (arg == "--samples") samples = max(1, atoi(value));
+    else if (arg == "--filter") filter = value;
+    else if (arg == "--out") out_path = value;
+    else if (arg == "--baseline") baseline = value;
+    else if (arg == "--threshold") threshold = atof(value);
+    else if (arg == "--compare" && i + 1 < argc) {
+      compare_old = value;
+      compare_new = argv[++i];
+    }
+    else usage();
+  }
+
+  if (compare_old) {
+    Results old_results, new_results;
+    std::string unit, new_unit;
+    if (!readResults(compare_old, old_results, unit)) {
+      perror(compare_old);
+      return 2;
+    }
+    if (!readResults(compare_new, new_results, new_unit)) {
+      perror(compare_new);
+      return 2;
+    }
+    if (unit != new_unit) {
+      fprintf(stderr, "ardusketch-bench: %s is in %s, %s in %s\n", compare_old,
+              unit.c_str(), compare_new, new_unit.c_str());
+      return 2;
+    }
+    return compare(old_results, new_results, unit, threshold) ? 1 : 0;
+  }
+
+  FILE *out = out_path ? fopen(out_path, "w") : stdout;
+  if (!out) {
+    perror(out_path);
+    return 2;
+  }
+  FilePrint print(out);
+  Results results;
+
+  ArduboyHost::captureSpi = false;
+  arduboy.start();
+
+  benchBegin(print, "host", "ns", commit);
+  bool first = true;
+  for (uint8_t i = 0; i < benchCount(); i++) {
+    BenchCase c;
+    BenchOp ops[BENCH_OPS];
+
+    benchCase(i, c);
+    if (filter && strcmp(filter, c.name) != 0)
+      continue;
+    benchPrepare(arduboy, i, c, ops);
+    double ns = timeCase(c, ops, samples);
+    benchFinish(arduboy, c);
+
+    unsigned long hundredths = (unsigned long)(ns * 100 + 0.5);
+    benchResult(print, c, first, hundredths / 100, hundredths % 100);
+    results[std::string(c.name) + " " + c.variant] = hundredths / 100.0;
+    first = false;
+  }
+  benchEnd(print);
+  if (out != stdout)
+    fclose(out);
+
+  if (baseline) {
+    Results old_results;
+    std::string unit;
+    if (!readResults(baseline, old_results, unit)) {
+      perror(baseline);
+      return 2;
+    }
+    return compare(old_results, results, "ns", threshold) ? 1 : 0;
+  }
+  return 0;
+}
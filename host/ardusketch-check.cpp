@@ -0,0 +1,169 @@
+/*********************************************************
+ *                                                       *
+ *                   ARDUSKETCH-CHECK                    *
+ *                                                       *
+ *   Checks the region transforms of the Arduboy         *
+ *   library against a pixel by pixel reference, on      *
+ *   each of ArduSketch's five canvases.                 *
+ *                                                       *
+ *  Build: make -C host check                            *
+ *********************************************************/
+
+/*
+ Usage:
+   ardusketch-check
+
+ Every canvas is filled with random pixels, transformed, and compared
+ with what the transform should have made of each pixel.  The whole
+ screen is compared, so a transform that writes outside its region is
+ caught too.  Prints a line for each mismatch and exits 1 if there was
+ any.
+*/
+
+#include <cstdio>
+#include <cstring>
+
+#include "Arduboy.h"
+
+Arduboy arduboy;
+
+// ArduSketch's canvases, as prep_display() places them
+static const struct { uint8_t x, y, width, height; } canvases[] = {
+  { 60, 28, 8, 8 },
+  { 56, 24, 16, 16 },
+  { 48, 16, 32, 32 },
+  { 32, 0, 64, 64 },
+  { 0, 0, 128, 64 },
+};
+
+typedef bool Screen[HEIGHT][WIDTH];
+
+static int failures = 0;
+
+static bool pixel(uint8_t x, uint8_t y)
+{
+  return arduboy.getBuffer()[(y / 8) * WIDTH + x] & (1 << (y & 7));
+}
+
+static void randomScreen(Screen &before)
+{
+  uint8_t *buffer = arduboy.getBuffer();
+  for (int i = 0; i < WIDTH * HEIGHT / 8; i++)
+    buffer[i] = random(256);
+  for (int y = 0; y < HEIGHT; y++)
+    for (int x = 0; x < WIDTH; x++)
+      before[y][x] = pixel(x, y);
+}
+
+static void compare(const char *name, int canvas, const Screen &expected)
+{
+  int wrong = 0;
+  for (int y = 0; y < HEIGHT; y++) {
+    for (int x = 0; x < WIDTH; x++) {
+      if (pixel(x, y) != expected[y][x] && !wrong++)
+        printf("%s on %dx%d: first wrong pixel at %d,%d\n", name,
+               canvases[canvas].width, canvases[canvas].height, x, y);
+    }
+  }
+  if (wrong) {
+    printf("%s on %dx%d: %d pixels wrong\n", name, canvases[canvas].width,
+           canvases[canvas].height, wrong);
+    failures++;
+  }
+}
+
+// expected[y][x] = before[sy][sx] for each pixel of the region, where
+// (sx, sy) comes from the transform's map of region coordinates
+template <class Map>
+static void check(const char *name, int canvas, Map map, void (*run)(int))
+{
+  Screen before, expected;
+  uint8_t cx = canvases[canvas].x, cy = canvases[canvas].y;
+  uint8_t w = canvases[canvas].width, h = canvases[canvas].height;
+
+  randomScreen(before);
+  memcpy(expected, before, sizeof(expected));
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      int sx = x, sy = y;
+      bool invert = map(x, y, w, h, sx, sy);
+      expected[cy + y][cx + x] = before[cy + sy][cx + sx] != invert;
+    }
+  }
+  run(canvas);
+  compare(name, canvas, expected);
+}
+
+static int dx, dy;
+
+#define CANVAS canvases[canvas].x, canvases[canvas].y, canvases[canvas].width, canvases[canvas].height
+
+// the paste source and destination, any alignment, cut to the canvas
+// the way screen_paste() cuts it
+static void checkCopyPaste(int canvas)
+{
+  Screen before, expected;
+  uint8_t clip[WIDTH * HEIGHT / 8];
+  uint8_t cx = canvases[canvas].x, cy = canvases[canvas].y;
+  uint8_t w = canvases[canvas].width, h = canvases[canvas].height;
+
+  for (int n = 0; n < 32; n++) {
+    uint8_t sx = random(w), sy = random(h);
+    uint8_t cw = random(1, w - sx + 1), ch = random(1, h - sy + 1);
+    uint8_t px = random(w), py = random(h);
+    uint8_t pw = min(cw, w - px), ph = min(ch, h - py);
+
+    randomScreen(before);
+    memcpy(expected, before, sizeof(expected));
+    for (int y = 0; y < ph; y++)
+      for (int x = 0; x < pw; x++)
+        expected[cy + py + y][cx + px + x] = before[cy + sy + y][cx + sx + x];
+    arduboy.copyRegion(cx + sx, cy + sy, cw, ch, clip);
+    arduboy.pasteRegion(clip, cw, cx + px, cy + py, pw, ph);
+    compare("copyRegion/pasteRegion", canvas, expected);
+  }
+}
+
+int main()
+{
+  randomSeed(1);
+  for (int canvas = 0; canvas < 5; canvas++) {
+    check("flipHorizontal", canvas, [](int x, int y, int w, int h, int &sx, int &sy) {
+      sx = w - 1 - x;
+      return false;
+    }, [](int canvas) { arduboy.flipHorizontal(CANVAS); });
+
+    check("flipVertical", canvas, [](int x, int y, int w, int h, int &sx, int &sy) {
+      sy = h - 1 - y;
+      return false;
+    }, [](int canvas) { arduboy.flipVertical(CANVAS); });
+
+    // clockwise, and nothing at all for a region that is not square
+    check("rotate90", canvas, [](int x, int y, int w, int h, int &sx, int &sy) {
+      if (w == h) {
+        sx = y;
+        sy = w - 1 - x;
+      }
+      return false;
+    }, [](int canvas) { arduboy.rotate90(CANVAS); });
+
+    check("invertRegion", canvas, [](int x, int y, int w, int h, int &sx, int &sy) {
+      return true;
+    }, [](int canvas) { arduboy.invertRegion(CANVAS); });
+
+    for (dx = -9; dx <= 9; dx += 3) {
+      for (dy = -7; dy <= 7; dy++) {
+        check("shiftRegion", canvas, [](int x, int y, int w, int h, int &sx, int &sy) {
+          sx = ((x - dx) % w + w) % w;
+          sy = ((y - dy) % h + h) % h;
+          return false;
+        }, [](int canvas) { arduboy.shiftRegion(CANVAS, dx, dy); });
+      }
+    }
+
+    checkCopyPaste(canvas);
+  }
+
+  printf("%s\n", failures ? "FAILED" : "all transforms match");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,190 @@
+/*********************************************************
+ *                                                       *
+ *                   ARDUSKETCH-HOST                     *
+ *                                                       *
+ *   Runs the sketch on Linux, on the stand-ins for the  *
+ *   Arduino core and the ATmega32u4 in this directory,  *
+ *   for a given stretch of virtual time.                *
+ *                                                       *
+ *   Buttons are scripted, Serial is read from a file    *
+ *   and what the sketch leaves behind can be written    *
+ *   out: its screen buffer, what the display shows,     *
+ *   the raw SPI stream, its Serial output and EEPROM.   *
+ *                                                       *
+ *  Build: make -C host                                  *
+ *********************************************************/
+
+/*
+ Usage:
+   ardusketch-host [options]
+
+   --time MS          virtual ms to run for (default 3000)
+   --key MS=BUTTONS   hold BUTTONS from MS on, any of u d l r a b, or none
+                      for nothing held; repeat for a sequence
+   --serial FILE      bytes for the sketch to read over Serial, - for stdin
+   --eeprom FILE      EEPROM image, read first if it exists and written after
+   --frame FILE       the Arduboy's screen buffer as a PBM image
+   --screen FILE      what the display shows as a PBM image
+   --spi FILE         every byte sent over SPI, commands and data
+   --out FILE         the sketch's Serial output (default stdout)
+
+ Example, open the 16x16 canvas and light a pixel, pressing after the
+ intro, which takes about 2.4s (ardusketch-sketch-check runs the same):
+   ardusketch-host --key 2500=a --key 2600= --key 2800=d --key 2900= \
+                   --key 3100=a --key 3200= --key 3400=a --key 3500= \
+                   --time 4000 --frame canvas.pbm
+
+ A lit pixel is white in the PBM images, as in ardusketch-convert.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Arduboy.h"
+#include "host.h"
+
+extern Arduboy display;
+void setup();
+void loop();
+
+static void usage()
+{
+  fprintf(stderr, "usage: ardusketch-host [--time MS] [--key MS=BUTTONS]... [--serial FILE]\n"
+                  "                       [--eeprom FILE] [--frame FILE] [--screen FILE]\n"
+                  "                       [--spi FILE] [--out FILE]\n");
+  exit(2);
+}
+
+static uint8_t parseButtons(const char *s)
+{
+  uint8_t buttons = 0;
+
+  for (; *s; s++) {
+    switch (*s) {
+      case 'u': buttons |= UP_BUTTON; break;
+      case 'd': buttons |= DOWN_BUTTON; break;
+      case 'l': buttons |= LEFT_BUTTON; break;
+      case 'r': buttons |= RIGHT_BUTTON; break;
+      case 'a': buttons |= A_BUTTON; break;
+      case 'b': buttons |= B_BUTTON; break;
+      case ',': break;
+      default:
+        if (strcmp(s, "none") == 0)
+          return 0;
+        fprintf(stderr, "ardusketch-host: unknown button '%c'\n", *s);
+        exit(2);
+    }
+  }
+  return buttons;
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &data)
+{
+  FILE *f = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+  if (!f)
+    return false;
+  int c;
+  while ((c = fgetc(f)) != EOF)
+    data.push_back(c);
+  if (f != stdin)
+    fclose(f);
+  return true;
+}
+
+static void writeFile(const char *path, const void *data, size_t length)
+{
+  FILE *f = fopen(path, "wb");
+  if (!f || fwrite(data, 1, length, f) != length) {
+    perror(path);
+    exit(1);
+  }
+  fclose(f);
+}
+
+// page ordered, a bit per pixel, as the Arduboy's buffer and the SSD1306
+static void writePBM(const char *path, const uint8_t *pages)
+{
+  std::string pbm = "P1\n" + std::to_string(WIDTH) + " " + std::to_string(HEIGHT) + "\n";
+
+  for (int y = 0; y < HEIGHT; y++) {
+    for (int x = 0; x < WIDTH; x++) {
+      bool lit = pages[(y / 8) * WIDTH + x] & (1 << (y & 7));
+      pbm += lit ? "0" : "1";
+      pbm += x + 1 < WIDTH ? " " : "\n";
+    }
+  }
+  writeFile(path, pbm.data(), pbm.size());
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long run_ms = 3000;
+  const char *eeprom_path = NULL, *frame_path = NULL, *screen_path = NULL;
+  const char *spi_path = NULL, *out_path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) usage();
+    const char *value = argv[++i];
+
+    if (arg == "--time") {
+      run_ms = strtoul(value, NULL, 10);
+    }
+    else if (arg == "--key") {
+      const char *eq = strchr(value, '=');
+      if (!eq) usage();
+      ArduboyHost::scheduleButtons(strtoul(value, NULL, 10) * 1000, parseButtons(eq + 1));
+    }
+    else if (arg == "--serial") {
+      std::vector<uint8_t> data;
+      if (!readFile(value, data)) {
+        perror(value);
+        return 1;
+      }
+      ArduboyHost::serialIn.assign(data.begin(), data.end());
+    }
+    else if (arg == "--eeprom") {
+      std::vector<uint8_t> data;
+      eeprom_path = value;
+      if (readFile(value, data))
+        memcpy(ArduboyHost::eeprom, data.data(), min(data.size(), sizeof(ArduboyHost::eeprom)));
+    }
+    else if (arg == "--frame") frame_path = value;
+    else if (arg == "--screen") screen_path = value;
+    else if (arg == "--spi") spi_path = value;
+    else if (arg == "--out") out_path = value;
+    else usage();
+  }
+
+  ArduboyHost::captureSpi = spi_path != NULL;
+  ArduboyHost::run(setup, loop, run_ms * 1000);
+
+  if (frame_path)
+    writePBM(frame_path, display.getBuffer());
+  if (screen_path) {
+    uint8_t shown[HOST_PANEL_BYTES];
+    for (int i = 0; i < HOST_PANEL_BYTES; i++) {
+      shown[i] = ArduboyHost::panelInverted ? ~ArduboyHost::panel[i] : ArduboyHost::panel[i];
+      if (!ArduboyHost::panelOn)
+        shown[i] = 0;
+    }
+    writePBM(screen_path, shown);
+  }
+  if (spi_path)
+    writeFile(spi_path, ArduboyHost::spi.data(), ArduboyHost::spi.size());
+  if (eeprom_path)
+    writeFile(eeprom_path, ArduboyHost::eeprom, sizeof(ArduboyHost::eeprom));
+  if (out_path)
+    writeFile(out_path, ArduboyHost::serialOut.data(), ArduboyHost::serialOut.size());
+  else
+    fwrite(ArduboyHost::serialOut.data(), 1, ArduboyHost::serialOut.size(), stdout);
+
+  fprintf(stderr, "%lu ms: %lu ticks, %lu sleeps, %lu frames pushed, "
+                  "%lu SPI data bytes, %lu SPI commands\n",
+          ArduboyHost::now / 1000, ArduboyHost::ticks, ArduboyHost::sleeps,
+          (unsigned long)display.spiPushes, ArduboyHost::spiData, ArduboyHost::spiCommands);
+  return 0;
+}
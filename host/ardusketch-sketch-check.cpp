@@ -0,0 +1,94 @@
+/*********************************************************
+ *                                                       *
+ *                ARDUSKETCH-SKETCH-CHECK                *
+ *                                                       *
+ *   Runs ArduSketch on the host through scripted        *
+ *   button presses and checks where each script ends.   *
+ *                                                       *
+ *  Build: make -C host check                            *
+ *********************************************************/
+
+/*
+ Usage:
+   ardusketch-sketch-check
+
+ The sketch is built into this program, so its state can be read at the
+ end of a run.  Each scenario runs in a child process of its own, from
+ reset.  Prints a line for each scenario that fails and exits 1 if there
+ was any.
+*/
+
+#include <cstdio>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../ArduSketch.ino"
+#include "host.h"
+
+struct Key
+{
+  unsigned long ms;
+  uint8_t buttons;
+};
+
+struct Scenario
+{
+  const char *name;
+  unsigned long run_ms;
+  std::vector<Key> keys;
+  bool (*passed)();
+};
+
+static const Scenario scenarios[] = {
+  // the first frame after the intro must see a press made during it
+  { "A pressed during the intro opens size select", 3500,
+    { { 1000, A_BUTTON }, { 1100, 0 } },
+    [] { return current_mode == MODE_SIZE_SELECT; } },
+
+  // the example in ardusketch-host.cpp
+  { "the documented example lights a pixel on the 16x16 canvas", 4000,
+    { { 2500, A_BUTTON }, { 2600, 0 }, { 2800, DOWN_BUTTON }, { 2900, 0 },
+      { 3100, A_BUTTON }, { 3200, 0 }, { 3400, A_BUTTON }, { 3500, 0 } },
+    [] {
+      return current_mode == MODE_DRAW && image_size_x == 16 && image_size_y == 16 &&
+             display.getPixel(cursor_x, cursor_y);
+    } },
+
+  // idle on the splash screen from about 2.5s, sleeping on nearly every
+  // tick rather than spinning toward a task due before the next one
+  { "the scheduler sleeps between tasks", 6000, { },
+    [] { return scheduler.sleeps > 3000000UL / TUNES_TICK_US; } },
+};
+
+static bool run(const Scenario &s)
+{
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+  if (pid == 0) {
+    for (const Key &key : s.keys)
+      ArduboyHost::scheduleButtons(key.ms * 1000, key.buttons);
+    ArduboyHost::run(setup, loop, s.run_ms * 1000);
+    _exit(s.passed() ? 0 : 1);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main()
+{
+  int failures = 0;
+
+  for (const Scenario &s : scenarios) {
+    if (!run(s)) {
+      printf("%s: FAILED\n", s.name);
+      failures++;
+    }
+  }
+  printf("%s\n", failures ? "FAILED" : "all scenarios pass");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+/*********************************************************
+ *                                                       *
+ *                ARDUSKETCH-SYNTH-CHECK                 *
+ *                                                       *
+ *   Checks the TUNES_SYNTH software synth: the PWM      *
+ *   levels its sample interrupt loads into OCR1A, and   *
+ *   that the interrupt only runs while a voice sounds.  *
+ *                                                       *
+ *  Build: make -C host check                            *
+ *********************************************************/
+
+/*
+ Usage:
+   ardusketch-synth-check
+
+ The library is built with TUNES_SYNTH for this.  The host never runs
+ Timer3, so the sample interrupt is called here directly, and the
+ sequencer tick is too.  Prints a line for each check that fails and
+ exits 1 if there was any.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "audio.h"
+
+#ifndef TUNES_SYNTH
+#error "build with -DTUNES_SYNTH"
+#endif
+
+ArduboyTunes tunes;
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what)
+{
+  if (!ok) {
+    printf("%s\n", what);
+    failures++;
+  }
+}
+
+static bool sampling()
+{
+  return TIMSK3 & _BV(OCIE3A);
+}
+
+// n samples as the interrupt makes them: '#' for one voice's level, '.'
+// for none and '?' for anything else
+static std::string samples(int n)
+{
+  std::string s;
+  for (int i = 0; i < n; i++) {
+    TIMER3_COMPA_vect();
+    s += OCR1A == TUNES_SYNTH_LEVEL ? '#' : OCR1A == 0 ? '.' : '?';
+  }
+  return s;
+}
+
+// rising edges and high samples over a second
+static void rises(int *edges, int *high)
+{
+  bool last = true;
+  *edges = *high = 0;
+  for (unsigned long i = 0; i < TUNES_SYNTH_RATE; i++) {
+    TIMER3_COMPA_vect();
+    bool on = OCR1A;
+    *edges += on && !last;
+    *high += on;
+    last = on;
+  }
+}
+
+// play notes from a score in SRAM and let the tick pick it up
+static void play(const byte *score)
+{
+  tunes.playScore<TunesSram>(score);
+  ArduboyTunes::tick();
+}
+
+static void ticks(int n)
+{
+  while (n--)
+    ArduboyTunes::tick();
+}
+
+int main()
+{
+  tunes.initChannel(9);
+  expect(!sampling(), "the sample interrupt runs before anything plays");
+
+  // A4, 440Hz, is 1845 a sample at 15625 samples a second: 17 or 18
+  // samples high, then as many low, from the stopped phase of 0xff00
+  static const byte a4[] = { 0x90, 69, 0x7f, 0xff };
+  play(a4);
+  expect(sampling(), "the sample interrupt is off while A4 plays");
+  expect(samples(72) ==
+         "#################..................##################..................#",
+         "A4 at a duty of 0x80 is not a 440Hz square wave");
+
+  // over a second, 440 cycles and half of it high
+  int edges, high;
+  rises(&edges, &high);
+  expect(edges >= 439 && edges <= 441, "A4 does not rise 440 times a second");
+  expect(high > 7800 && high < 7830, "A4 is not high half of the time");
+
+  // a quarter duty from the start of a cycle
+  tunes.stopScore();
+  ticks(1);
+  tunes.setDuty(0, 0x40);
+  play(a4);
+  expect(samples(72) ==
+         "#########..........................#########...........................#",
+         "A4 at a duty of 0x40 is not high a quarter of the time");
+  tunes.setDuty(0, 0x80);
+
+  // A4 and A5 together only ever mix to 0, one level or two
+  static const byte a4a5[] = { 0x90, 69, 0x91, 81, 0x7f, 0xff };
+  tunes.stopScore();
+  ticks(1);
+  play(a4a5);
+  bool both = false, other = false;
+  for (int i = 0; i < 1000; i++) {
+    TIMER3_COMPA_vect();
+    both |= OCR1A == 2 * TUNES_SYNTH_LEVEL;
+    other |= OCR1A != 0 && OCR1A != TUNES_SYNTH_LEVEL && OCR1A != 2 * TUNES_SYNTH_LEVEL;
+  }
+  expect(both && !other, "A4 and A5 do not mix to 0, 1 or 2 levels");
+
+  // silence stops the interrupt and leaves the carrier low
+  tunes.stopScore();
+  ticks(1);
+  expect(!sampling(), "the sample interrupt still runs after the score stopped");
+  expect(OCR1A == 0, "the carrier is not left low after the score stopped");
+
+  // a tone() on the last voice, then one that runs the interrupt for its
+  // duration and stops it again
+  tunes.tone(1000, 0);
+  ticks(1);
+  expect(sampling(), "the sample interrupt is off during a tone()");
+  rises(&edges, &high);
+  expect(edges >= 999 && edges <= 1001, "a 1kHz tone() does not rise 1000 times a second");
+  tunes.tone(1000, 5);
+  ticks(5 * 1000 / TUNES_TICK_US + 1);
+  expect(!sampling(), "the sample interrupt still runs after the tone() ended");
+
+  // closed channels stop it too
+  play(a4);
+  tunes.closeChannels();
+  expect(!sampling(), "the sample interrupt still runs after closeChannels()");
+
+  printf("%s\n", failures ? "FAILED" : "synth matches");
+  return failures ? 1 : 0;
+}
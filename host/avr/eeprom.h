@@ -0,0 +1,15 @@
+#ifndef _AVR_EEPROM_H_
+#define _AVR_EEPROM_H_
+
+// Host stand-in for the EEPROM, ArduboyHost::eeprom.  Writes are done at
+// once, so eeprom_is_ready() is always true.
+
+#include <stdint.h>
+
+uint8_t eeprom_read_byte(const uint8_t *p);
+void eeprom_write_byte(uint8_t *p, uint8_t value);
+void eeprom_update_byte(uint8_t *p, uint8_t value);
+#define eeprom_is_ready() 1
+#define eeprom_busy_wait()
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef _AVR_INTERRUPT_H_
+#define _AVR_INTERRUPT_H_
+
+// Interrupt handlers are ordinary functions on the host, called by the
+// clock and the pins in host.cpp
+
+#include <avr/io.h>
+
+#define ISR(vector) extern "C" void vector(void)
+
+void host_sei();
+#define sei() host_sei()
+#define cli() (SREG &= ~_BV(SREG_I))
+
+extern "C" {
+void TIMER0_COMPA_vect(void);
+void TIMER1_COMPA_vect(void);
+void TIMER3_COMPA_vect(void);
+void PCINT0_vect(void);
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef _AVR_IO_H_
+#define _AVR_IO_H_
+
+// Host stand-in for the ATmega32u4 registers the sources touch.  They are
+// plain bytes in host.cpp, apart from the few that need to act like
+// hardware: the ADC finishes a conversion at once, and the stack pointer
+// and RAMEND point into a stand-in for free RAM (see ArduboyHost::ram).
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+
+extern volatile uint8_t SREG;
+#define SREG_I 7
+
+extern volatile uint8_t PINB, DDRB, PORTB;
+extern volatile uint8_t PINC, DDRC, PORTC;
+extern volatile uint8_t PIND, DDRD, PORTD;
+extern volatile uint8_t PINE, DDRE, PORTE;
+extern volatile uint8_t PINF, DDRF, PORTF;
+
+extern volatile uint8_t TCCR0A, TCCR0B, TIMSK0, OCR0A, OCR0B, TCNT0;
+extern volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1;
+extern volatile uint16_t OCR1A, OCR1B, OCR1C, TCNT1;
+extern volatile uint8_t TCCR3A, TCCR3B, TCCR3C, TIMSK3;
+extern volatile uint16_t OCR3A, OCR3B, OCR3C, TCNT3;
+
+#define TOIE0 0
+#define OCIE0A 1
+#define OCIE0B 2
+
+#define WGM10 0
+#define WGM11 1
+#define COM1C0 2
+#define COM1C1 3
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define OCIE1C 3
+
+#define WGM30 0
+#define WGM31 1
+#define COM3C0 2
+#define COM3C1 3
+#define COM3B0 4
+#define COM3B1 5
+#define COM3A0 6
+#define COM3A1 7
+#define CS30 0
+#define CS31 1
+#define CS32 2
+#define WGM32 3
+#define WGM33 4
+#define TOIE3 0
+#define OCIE3A 1
+#define OCIE3B 2
+#define OCIE3C 3
+
+extern volatile uint8_t PCICR, PCIFR, PCMSK0;
+#define PCIE0 0
+
+extern volatile uint8_t ADMUX, ADCSRB;
+#define MUX0 0
+#define MUX1 1
+#define MUX2 2
+#define MUX3 3
+#define MUX4 4
+#define ADLAR 5
+#define REFS0 6
+#define REFS1 7
+#define MUX5 5
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+
+volatile uint8_t *host_adcsra();
+uint16_t host_adc();
+#define ADCSRA (*host_adcsra())
+#define ADCW (host_adc())
+#define ADC ADCW
+
+extern volatile uint8_t CLKPR;
+#define CLKPCE 7
+
+extern volatile uint8_t USBSTA;
+#define VBUS 0
+
+uintptr_t host_sp();
+uintptr_t host_ramend();
+#define SP (host_sp())
+#define RAMEND (host_ramend())
+
+#define E2END 0x3FF
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __AVR_POWER_H_
+#define __AVR_POWER_H_
+
+// Nothing to power down on the host
+
+#define power_adc_enable()
+#define power_adc_disable()
+#define power_usart0_enable()
+#define power_usart0_disable()
+#define power_usart1_enable()
+#define power_usart1_disable()
+#define power_twi_enable()
+#define power_twi_disable()
+#define power_timer1_enable()
+#define power_timer1_disable()
+#define power_timer2_enable()
+#define power_timer2_disable()
+#define power_timer3_enable()
+#define power_timer3_disable()
+#define power_usb_enable()
+#define power_usb_disable()
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _AVR_SLEEP_H_
+#define _AVR_SLEEP_H_
+
+// Sleeping on the host moves the clock on to the next interrupt, see
+// ArduboyHost::sleep()
+
+#include <stdint.h>
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC 1
+#define SLEEP_MODE_PWR_DOWN 2
+#define SLEEP_MODE_PWR_SAVE 3
+#define SLEEP_MODE_STANDBY 6
+#define SLEEP_MODE_EXT_STANDBY 7
+
+void host_set_sleep_mode(uint8_t mode);
+void host_sleep_cpu();
+#define set_sleep_mode(mode) host_set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu() host_sleep_cpu()
+#define sleep_mode() host_sleep_cpu()
+
+#endif
@@ -0,0 +1,127 @@
+/*********************************************************
+ *                                                       *
+ *                      BENCH-AVR                        *
+ *                                                       *
+ *   The cases in bench.cpp on the ATmega32u4, timed in  *
+ *   CPU cycles with Timer1 at ck/1.  Runs the same on   *
+ *   an Arduboy and in simavr, and writes the same JSON  *
+ *   as ardusketch-bench to Serial1 (the simulator's     *
+ *   UART) and to the USB Serial.                        *
+ *                                                       *
+ *  Build: make -C host bench-avr   (needs avr-gcc and   *
+ *         the Arduino AVR core, see the Makefile)       *
+ *********************************************************/
+
+/*
+ Every interrupt but the Timer1 overflow is off while a case runs, so the
+ count is the primitive alone: no system tick and no USB.  The cost of
+ the loop in benchRun() is measured with an empty case and taken off.
+ Nothing is drawn on the device's screen but display() and the screen
+ renderers, which send the frame over SPI as usual.
+
+ When it is done it sleeps with interrupts off, which ends simavr.
+*/
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+#include "bench.h"
+
+#ifndef BENCH_COMMIT
+#define BENCH_COMMIT "unknown"
+#endif
+
+Arduboy arduboy;
+
+static volatile uint16_t timer1_overflows;
+
+ISR(TIMER1_OVF_vect)
+{
+  timer1_overflows++;
+}
+
+// the same text to the simulator's UART and to USB
+class BenchOut : public Print
+{
+public:
+  virtual size_t write(uint8_t c)
+  {
+    Serial1.write(c);
+    Serial.write(c);
+    return 1;
+  }
+};
+
+static BenchOut out;
+
+// cycles for one run of a case
+static uint32_t timeRun(const BenchCase &c, const BenchOp *ops)
+{
+  uint8_t timsk0 = TIMSK0, timsk3 = TIMSK3, udien = UDIEN;
+  uint16_t count;
+
+  TIMSK0 = 0;
+  TIMSK3 = 0;
+  UDIEN = 0;
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TCNT1 = 0;
+  TIFR1 = _BV(TOV1);
+  TIMSK1 = _BV(TOIE1);
+  timer1_overflows = 0;
+  TCCR1B = _BV(CS10);
+
+  benchRun(arduboy, c, ops);
+
+  TCCR1B = 0;
+  count = TCNT1;
+  // an overflow the interrupt has not seen yet
+  if (TIFR1 & _BV(TOV1))
+    timer1_overflows++;
+  TIMSK1 = 0;
+  TIMSK0 = timsk0;
+  TIMSK3 = timsk3;
+  UDIEN = udien;
+  return ((uint32_t)timer1_overflows << 16) + count;
+}
+
+void setup()
+{
+  Serial1.begin(115200);
+  Serial.begin(115200);
+  arduboy.start();
+  // give a USB terminal a moment to open
+  while (!Serial && millis() < 2000);
+
+  BenchCase empty;
+  BenchOp ops[BENCH_OPS];
+  memset(&empty, 0, sizeof(empty));
+  empty.kind = 0xFF;
+  memset(ops, 0, sizeof(ops));
+  uint32_t overhead = timeRun(empty, ops);
+
+  benchBegin(out, "avr", "cycles", BENCH_COMMIT);
+  for (uint8_t i = 0; i < benchCount(); i++) {
+    BenchCase c;
+
+    benchCase(i, c);
+    benchPrepare(arduboy, i, c, ops);
+    uint32_t cycles = timeRun(c, ops);
+    benchFinish(arduboy, c);
+
+    cycles = cycles > overhead ? cycles - overhead : 0;
+    uint32_t hundredths = (cycles * 100 + BENCH_OPS / 2) / BENCH_OPS;
+    benchResult(out, c, i == 0, hundredths / 100, hundredths % 100);
+  }
+  benchEnd(out);
+  Serial1.flush();
+  Serial.flush();
+
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  cli();
+  sleep_enable();
+  sleep_cpu();
+}
+
+void loop()
+{
+}
@@ -0,0 +1,244 @@
+#include "bench.h"
+#include "glcdfont.c"
+
+// the font doubles as sprite data, it is in flash on both targets
+#define BENCH_BITMAP_DATA (font + 5)
+
+static const BenchCase bench_cases[] PROGMEM = {
+  { "drawPixel",        "in",         BENCH_PIXEL,         0,  0 },
+  { "drawPixel",        "clip",       BENCH_PIXEL,         0,  BENCH_CLIP },
+  { "drawLine",         "8",          BENCH_LINE,          8,  0 },
+  { "drawLine",         "64",         BENCH_LINE,          64, 0 },
+  { "drawLine",         "clip",       BENCH_LINE,          64, BENCH_CLIP },
+  { "fillRect",         "8x8",        BENCH_FILL_RECT,     8,  0 },
+  { "fillRect",         "32x32",      BENCH_FILL_RECT,     32, 0 },
+  { "fillRect",         "128x64",     BENCH_FILL_RECT,     0,  0 },
+  { "fillRect",         "clip 32x32", BENCH_FILL_RECT,     32, BENCH_CLIP },
+  { "fillCircle",       "r4",         BENCH_FILL_CIRCLE,   4,  0 },
+  { "fillCircle",       "r16",        BENCH_FILL_CIRCLE,   16, 0 },
+  { "fillCircle",       "r31",        BENCH_FILL_CIRCLE,   31, 0 },
+  { "fillCircle",       "clip r16",   BENCH_FILL_CIRCLE,   16, BENCH_CLIP },
+  { "fillTriangle",     "8",          BENCH_FILL_TRIANGLE, 8,  0 },
+  { "fillTriangle",     "64",         BENCH_FILL_TRIANGLE, 64, 0 },
+  { "fillTriangle",     "clip",       BENCH_FILL_TRIANGLE, 64, BENCH_CLIP },
+  { "drawBitmap",       "8x8",        BENCH_BITMAP,        8,  0 },
+  { "drawBitmap",       "16x16",      BENCH_BITMAP,        16, 0 },
+  { "drawBitmap",       "32x32",      BENCH_BITMAP,        32, 0 },
+  { "drawBitmap",       "16x16 y+3",  BENCH_BITMAP,        16, BENCH_UNALIGNED },
+  { "drawBitmap",       "clip 16x16", BENCH_BITMAP,        16, BENCH_CLIP },
+  { "drawSlowXYBitmap", "8x8",        BENCH_SLOW_BITMAP,   8,  0 },
+  { "drawSlowXYBitmap", "16x16",      BENCH_SLOW_BITMAP,   16, 0 },
+  { "drawSlowXYBitmap", "32x32",      BENCH_SLOW_BITMAP,   32, 0 },
+  { "drawSlowXYBitmap", "clip 16x16", BENCH_SLOW_BITMAP,   16, BENCH_CLIP },
+  { "drawChar",         "size 1",     BENCH_CHAR,          1,  0 },
+  { "drawChar",         "size 2",     BENCH_CHAR,          2,  0 },
+  { "drawChar",         "size 4",     BENCH_CHAR,          4,  0 },
+  { "drawChar",         "clip 1",     BENCH_CHAR,          1,  BENCH_CLIP },
+  { "display",          "128x64",     BENCH_DISPLAY,       0,  0 },
+  { "drawScreen1X",     "cursor",     BENCH_SCREEN_1X,     1,  0 },
+  { "drawScreen1X",     "onion",      BENCH_SCREEN_1X,     1,  BENCH_ONION },
+  { "drawScreen2X",     "cursor",     BENCH_SCREEN_2X,     2,  0 },
+  { "drawScreen2X",     "onion",      BENCH_SCREEN_2X,     2,  BENCH_ONION },
+  { "drawScreen4X",     "cursor",     BENCH_SCREEN_4X,     4,  0 },
+  { "drawScreen4X",     "onion",      BENCH_SCREEN_4X,     4,  BENCH_ONION },
+};
+
+uint8_t benchCount()
+{
+  return sizeof(bench_cases) / sizeof(bench_cases[0]);
+}
+
+void benchCase(uint8_t i, BenchCase &c)
+{
+  memcpy_P(&c, &bench_cases[i], sizeof(c));
+}
+
+// a w by h shape's corner, on screen, or half off one edge when clipped
+static void place(BenchOp &op, int16_t w, int16_t h, bool clip)
+{
+  op.x0 = random(0, WIDTH - w + 1);
+  op.y0 = random(0, HEIGHT - h + 1);
+  if (!clip)
+    return;
+  if (random(2))
+    op.x0 = random(2) ? -w / 2 : WIDTH - w / 2;
+  else
+    op.y0 = random(2) ? -h / 2 : HEIGHT - h / 2;
+}
+
+void benchPrepare(Arduboy &arduboy, uint8_t i, const BenchCase &c, BenchOp *ops)
+{
+  bool clip = c.flags & BENCH_CLIP;
+  int16_t s = c.size;
+
+  randomSeed(BENCH_SEED + i);
+  arduboy.clearDisplay();
+  for (uint8_t n = 0; n < BENCH_OPS; n++) {
+    BenchOp &op = ops[n];
+    memset(&op, 0, sizeof(op));
+    switch (c.kind) {
+      case BENCH_PIXEL:
+        if (clip) {
+          op.x0 = random(-WIDTH / 2, WIDTH * 3 / 2);
+          op.y0 = random(-HEIGHT / 2, HEIGHT * 3 / 2);
+        } else {
+          place(op, 1, 1, false);
+        }
+        break;
+      case BENCH_LINE:
+        if (clip) {
+          // from beyond the left edge to beyond the right one
+          op.x0 = random(-WIDTH / 2, 0);
+          op.y0 = random(-HEIGHT / 2, HEIGHT * 3 / 2);
+          op.x1 = random(WIDTH, WIDTH * 3 / 2);
+          op.y1 = random(-HEIGHT / 2, HEIGHT * 3 / 2);
+        } else {
+          // up to s pixels across and down, either way
+          place(op, 1, 1, false);
+          op.x1 = constrain(op.x0 + random(-s, s + 1), 0, WIDTH - 1);
+          op.y1 = constrain(op.y0 + random(-s, s + 1), 0, HEIGHT - 1);
+        }
+        break;
+      case BENCH_FILL_RECT:
+        op.x1 = s ? s : WIDTH;
+        op.y1 = s ? s : HEIGHT;
+        place(op, op.x1, op.y1, clip);
+        break;
+      case BENCH_FILL_CIRCLE:
+        place(op, 2 * s + 1, 2 * s + 1, clip);
+        op.x0 += s;
+        op.y0 += s;
+        break;
+      case BENCH_FILL_TRIANGLE:
+        if (clip) {
+          op.x0 = random(-WIDTH / 2, WIDTH * 3 / 2);
+          op.y0 = random(-HEIGHT / 2, HEIGHT * 3 / 2);
+          op.x1 = random(-WIDTH / 2, WIDTH * 3 / 2);
+          op.y1 = random(-HEIGHT / 2, HEIGHT * 3 / 2);
+          op.x2 = random(-WIDTH / 2, WIDTH * 3 / 2);
+          op.y2 = random(-HEIGHT / 2, HEIGHT * 3 / 2);
+        } else {
+          place(op, s, min(s, HEIGHT), false);
+          op.x1 = op.x0 + random(s);
+          op.y1 = op.y0 + random(min(s, HEIGHT));
+          op.x2 = op.x0 + random(s);
+          op.y2 = op.y0 + random(min(s, HEIGHT));
+        }
+        break;
+      case BENCH_BITMAP:
+      case BENCH_SLOW_BITMAP:
+        place(op, s, s, clip);
+        if (!clip)
+          op.y0 &= ~7;
+        if (c.flags & BENCH_UNALIGNED && op.y0 + s + 3 <= HEIGHT)
+          op.y0 += 3;
+        break;
+      case BENCH_CHAR:
+        place(op, 6 * s, 8 * s, clip);
+        op.x1 = random(' ', 127);
+        break;
+      default:
+        // whole screens: a cursor on the canvas
+        op.x0 = random(WIDTH);
+        op.y0 = random(HEIGHT);
+        break;
+    }
+  }
+
+  if (c.kind >= BENCH_DISPLAY) {
+    // something on the screen to send
+    for (uint8_t y = 0; y < HEIGHT; y += 32)
+      for (uint8_t x = 0; x < WIDTH; x += 32)
+        arduboy.drawBitmap(x, y, BENCH_BITMAP_DATA, 32, 32, WHITE);
+    arduboy.prepZoomSwitch(c.size);
+    if (c.flags & BENCH_ONION)
+      arduboy.setOverlay(BENCH_BITMAP_DATA + 128, 0, 0, 64, 32, OVERLAY_ONION);
+  }
+}
+
+void benchRun(Arduboy &arduboy, const BenchCase &c, const BenchOp *ops)
+{
+  for (uint8_t n = 0; n < BENCH_OPS; n++) {
+    const BenchOp &op = ops[n];
+    switch (c.kind) {
+      case BENCH_PIXEL:
+        arduboy.drawPixel(op.x0, op.y0, WHITE);
+        break;
+      case BENCH_LINE:
+        arduboy.drawLine(op.x0, op.y0, op.x1, op.y1, WHITE);
+        break;
+      case BENCH_FILL_RECT:
+        arduboy.fillRect(op.x0, op.y0, op.x1, op.y1, WHITE);
+        break;
+      case BENCH_FILL_CIRCLE:
+        arduboy.fillCircle(op.x0, op.y0, c.size, WHITE);
+        break;
+      case BENCH_FILL_TRIANGLE:
+        arduboy.fillTriangle(op.x0, op.y0, op.x1, op.y1, op.x2, op.y2, WHITE);
+        break;
+      case BENCH_BITMAP:
+        arduboy.drawBitmap(op.x0, op.y0, BENCH_BITMAP_DATA, c.size, c.size, WHITE);
+        break;
+      case BENCH_SLOW_BITMAP:
+        arduboy.drawSlowXYBitmap(op.x0, op.y0, BENCH_BITMAP_DATA, c.size, c.size, WHITE);
+        break;
+      case BENCH_CHAR:
+        arduboy.drawChar(op.x0, op.y0, op.x1, WHITE, BLACK, c.size);
+        break;
+      case BENCH_DISPLAY:
+        arduboy.display();
+        break;
+      case BENCH_SCREEN_1X:
+        arduboy.drawScreen1X(op.x0, op.y0);
+        break;
+      case BENCH_SCREEN_2X:
+        arduboy.drawScreen2X(op.x0, op.y0);
+        break;
+      case BENCH_SCREEN_4X:
+        arduboy.drawScreen4X(op.x0, op.y0);
+        break;
+    }
+  }
+}
+
+void benchFinish(Arduboy &arduboy, const BenchCase &c)
+{
+  arduboy.clearOverlay();
+}
+
+void benchBegin(Print &out, const char *target, const char *unit, const char *commit)
+{
+  out.print(F("{\n  \"target\": \""));
+  out.print(target);
+  out.print(F("\",\n  \"unit\": \""));
+  out.print(unit);
+  out.print(F("\",\n  \"commit\": \""));
+  out.print(commit);
+  out.print(F("\",\n  \"seed\": "));
+  out.print(BENCH_SEED);
+  out.print(F(",\n  \"ops\": "));
+  out.print(BENCH_OPS);
+  out.print(F(",\n  \"results\": ["));
+}
+
+// per_op is whole.hundredths of the unit per shape drawn
+void benchResult(Print &out, const BenchCase &c, bool first, unsigned long whole, unsigned hundredths)
+{
+  out.print(first ? F("\n") : F(",\n"));
+  out.print(F("    {\"name\": \""));
+  out.print(c.name);
+  out.print(F("\", \"variant\": \""));
+  out.print(c.variant);
+  out.print(F("\", \"per_op\": "));
+  out.print(whole);
+  out.print('.');
+  if (hundredths < 10)
+    out.print('0');
+  out.print(hundredths);
+  out.print('}');
+}
+
+void benchEnd(Print &out)
+{
+  out.print(F("\n  ]\n}\n"));
+}
@@ -0,0 +1,60 @@
+#ifndef ArduboyBench_h
+#define ArduboyBench_h
+
+// Drawing benchmarks shared by the host runner (ardusketch-bench.cpp)
+// and the device runner (bench-avr.cpp).  Each case draws BENCH_OPS
+// shapes whose positions come from random() seeded with BENCH_SEED and
+// the case number, and random() matches avr-libc's on the host, so both
+// runners draw exactly the same pixels.
+
+#include <Arduino.h>
+#include "Arduboy.h"
+
+#define BENCH_SEED 0x5EED
+#define BENCH_OPS 16   // shapes per run of a case
+
+// what a case draws
+#define BENCH_PIXEL 0
+#define BENCH_LINE 1
+#define BENCH_FILL_RECT 2
+#define BENCH_FILL_CIRCLE 3
+#define BENCH_FILL_TRIANGLE 4
+#define BENCH_BITMAP 5
+#define BENCH_SLOW_BITMAP 6
+#define BENCH_CHAR 7
+#define BENCH_DISPLAY 8
+#define BENCH_SCREEN_1X 9
+#define BENCH_SCREEN_2X 10
+#define BENCH_SCREEN_4X 11
+
+struct BenchCase
+{
+  char name[20];      // the Arduboy function
+  char variant[12];   // its size and whether it is clipped
+  uint8_t kind;
+  uint8_t size;       // length, side, radius, text size; 0 for a full screen
+  uint8_t flags;
+};
+
+#define BENCH_CLIP 0x01      // partly or wholly off screen
+#define BENCH_UNALIGNED 0x02 // bitmaps not on a page boundary
+#define BENCH_ONION 0x04     // zoomed screens with an onion skin overlay
+
+// one shape: a position and whatever else the kind needs
+struct BenchOp
+{
+  int16_t x0, y0, x1, y1, x2, y2;
+};
+
+uint8_t benchCount();
+void benchCase(uint8_t i, BenchCase &c);
+void benchPrepare(Arduboy &arduboy, uint8_t i, const BenchCase &c, BenchOp *ops);
+void benchRun(Arduboy &arduboy, const BenchCase &c, const BenchOp *ops);
+void benchFinish(Arduboy &arduboy, const BenchCase &c);
+
+// Results as JSON, one case per line so they diff well between commits
+void benchBegin(Print &out, const char *target, const char *unit, const char *commit);
+void benchResult(Print &out, const BenchCase &c, bool first, unsigned long whole, unsigned hundredths);
+void benchEnd(Print &out);
+
+#endif
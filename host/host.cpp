@@ -0,0 +1,653 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <EEPROM.h>
+#include <avr/sleep.h>
+#include "host.h"
+#include "audio.h"
+
+static_assert(HOST_TICK_US == TUNES_TICK_US, "the host tick must match the device's");
+
+/**********************************
+ * Registers                      *
+ **********************************/
+
+volatile uint8_t SREG = _BV(SREG_I);   // the core's init() enables interrupts
+
+// nothing pressed: every button pin pulled up
+volatile uint8_t PINB = 0xFF, DDRB, PORTB;
+volatile uint8_t PINC = 0xFF, DDRC, PORTC;
+volatile uint8_t PIND = 0xFF, DDRD, PORTD;
+volatile uint8_t PINE = 0xFF, DDRE, PORTE;
+volatile uint8_t PINF = 0xFF, DDRF, PORTF;
+
+volatile uint8_t TCCR0A, TCCR0B, TIMSK0, OCR0A, OCR0B, TCNT0;
+volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1;
+volatile uint16_t OCR1A, OCR1B, OCR1C, TCNT1;
+volatile uint8_t TCCR3A, TCCR3B, TCCR3C, TIMSK3;
+volatile uint16_t OCR3A, OCR3B, OCR3C, TCNT3;
+volatile uint8_t PCICR, PCIFR, PCMSK0;
+volatile uint8_t ADMUX, ADCSRB;
+volatile uint8_t CLKPR;
+volatile uint8_t USBSTA = _BV(VBUS);   // USB plugged in
+
+static volatile uint8_t adcsra;
+
+// conversions finish as soon as they start
+volatile uint8_t *host_adcsra()
+{
+  adcsra &= ~_BV(ADSC);
+  return &adcsra;
+}
+
+// some noise for initRandomSeed(), the same on every run
+uint16_t host_adc()
+{
+  return (ArduboyHost::now * 2654435761UL) >> 22 & 0x3FF;
+}
+
+// The RAM monitor paints and scans ArduboyHost::ram, not the host stack
+char __heap_start;
+char *__brkval = (char *)ArduboyHost::ram;
+
+uintptr_t host_sp()
+{
+  return (uintptr_t)(ArduboyHost::ram + HOST_FREE_RAM);
+}
+
+uintptr_t host_ramend()
+{
+  return (uintptr_t)(ArduboyHost::ram + HOST_FREE_RAM - 1);
+}
+
+
+/**********************************
+ * Pins                           *
+ **********************************/
+
+// Leonardo pin mapping, digital 0 to 23 (A5)
+static const uint8_t pin_port[] = {
+  PD, PD, PD, PD, PD, PC, PD, PE, PB, PB, PB, PB, PD, PC, PB, PB,
+  PB, PB, PF, PF, PF, PF, PF, PF
+};
+static const uint8_t pin_bit[] = {
+  2, 3, 1, 0, 4, 6, 7, 6, 4, 5, 6, 7, 6, 7, 3, 1,
+  2, 0, 7, 6, 5, 4, 1, 0
+};
+
+uint8_t digitalPinToPort(uint8_t pin)
+{
+  return pin < sizeof(pin_port) ? pin_port[pin] : NOT_A_PORT;
+}
+
+uint8_t digitalPinToBitMask(uint8_t pin)
+{
+  return pin < sizeof(pin_bit) ? _BV(pin_bit[pin]) : 0;
+}
+
+volatile uint8_t *portOutputRegister(uint8_t port)
+{
+  switch (port) {
+    case PB: return &PORTB;
+    case PC: return &PORTC;
+    case PD: return &PORTD;
+    case PE: return &PORTE;
+    case PF: return &PORTF;
+  }
+  return NULL;
+}
+
+volatile uint8_t *portInputRegister(uint8_t port)
+{
+  switch (port) {
+    case PB: return &PINB;
+    case PC: return &PINC;
+    case PD: return &PIND;
+    case PE: return &PINE;
+    case PF: return &PINF;
+  }
+  return NULL;
+}
+
+volatile uint8_t *portModeRegister(uint8_t port)
+{
+  switch (port) {
+    case PB: return &DDRB;
+    case PC: return &DDRC;
+    case PD: return &DDRD;
+    case PE: return &DDRE;
+    case PF: return &DDRF;
+  }
+  return NULL;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  volatile uint8_t *ddr = portModeRegister(digitalPinToPort(pin));
+  volatile uint8_t *out = portOutputRegister(digitalPinToPort(pin));
+  uint8_t mask = digitalPinToBitMask(pin);
+
+  if (!ddr) return;
+  if (mode == OUTPUT) {
+    *ddr |= mask;
+  } else {
+    *ddr &= ~mask;
+    if (mode == INPUT_PULLUP) *out |= mask;
+    else *out &= ~mask;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  volatile uint8_t *out = portOutputRegister(digitalPinToPort(pin));
+  if (!out) return;
+  if (val) *out |= digitalPinToBitMask(pin);
+  else *out &= ~digitalPinToBitMask(pin);
+}
+
+int digitalRead(uint8_t pin)
+{
+  volatile uint8_t *in = portInputRegister(digitalPinToPort(pin));
+  return in && (*in & digitalPinToBitMask(pin)) ? HIGH : LOW;
+}
+
+
+/**********************************
+ * Time                           *
+ **********************************/
+
+unsigned long millis()
+{
+  ArduboyHost::advance(ArduboyHost::callCost);
+  return ArduboyHost::now / 1000;
+}
+
+unsigned long micros()
+{
+  ArduboyHost::advance(ArduboyHost::callCost);
+  return ArduboyHost::now;
+}
+
+void delay(unsigned long ms)
+{
+  ArduboyHost::advance(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  ArduboyHost::advance(us);
+}
+
+void host_set_sleep_mode(uint8_t mode)
+{
+  ArduboyHost::sleepMode = mode;
+}
+
+void host_sleep_cpu()
+{
+  ArduboyHost::sleep();
+}
+
+void host_sei()
+{
+  SREG |= _BV(SREG_I);
+  ArduboyHost::runPending();
+}
+
+
+/**********************************
+ * Numbers                        *
+ **********************************/
+
+// avr-libc's random(), so seeded sequences match the device
+static uint32_t random_state = 1;
+
+static long nextRandom()
+{
+  int32_t x = random_state;
+  int32_t hi, lo;
+
+  if (x == 0)
+    x = 123459876L;
+  hi = x / 127773L;
+  lo = x % 127773L;
+  x = 16807L * lo - 2836L * hi;
+  if (x < 0)
+    x += 0x7fffffffL;
+  random_state = x;
+  return x % 0x80000000UL;
+}
+
+void randomSeed(unsigned long seed)
+{
+  if (seed != 0)
+    random_state = seed;
+}
+
+long random(long howbig)
+{
+  if (howbig == 0)
+    return 0;
+  return nextRandom() % howbig;
+}
+
+long random(long howsmall, long howbig)
+{
+  if (howsmall >= howbig)
+    return howsmall;
+  return random(howbig - howsmall) + howsmall;
+}
+
+char *ultoa(unsigned long value, char *string, int radix)
+{
+  char digits[sizeof(unsigned long) * 8 + 1];
+  int n = 0;
+
+  do {
+    int d = value % radix;
+    digits[n++] = d < 10 ? '0' + d : 'a' + d - 10;
+    value /= radix;
+  } while (value);
+  for (int i = 0; i < n; i++)
+    string[i] = digits[n - 1 - i];
+  string[n] = '\0';
+  return string;
+}
+
+char *ltoa(long value, char *string, int radix)
+{
+  if (value < 0 && radix == 10) {
+    string[0] = '-';
+    ultoa(-(unsigned long)value, string + 1, radix);
+    return string;
+  }
+  return ultoa(value, string, radix);
+}
+
+// int is 16 bits on the device
+char *itoa(int value, char *string, int radix)
+{
+  if (radix != 10)
+    return ultoa((uint16_t)value, string, radix);
+  return ltoa((int16_t)value, string, radix);
+}
+
+char *utoa(unsigned value, char *string, int radix)
+{
+  return ultoa((uint16_t)value, string, radix);
+}
+
+
+/**********************************
+ * Print                          *
+ **********************************/
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--)
+    n += write(*buffer++);
+  return n;
+}
+
+size_t Print::print(const __FlashStringHelper *s)
+{
+  return write((const char *)s);
+}
+
+size_t Print::print(const char str[])
+{
+  return write(str);
+}
+
+size_t Print::print(char c)
+{
+  return write(c);
+}
+
+size_t Print::print(unsigned char b, int base)
+{
+  return print((unsigned long)b, base);
+}
+
+size_t Print::print(int n, int base)
+{
+  return print((long)n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+  if (base == 0)
+    return write((uint8_t)n);
+  if (base == 10 && n < 0)
+    return print('-') + printNumber(-(unsigned long)n, 10);
+  return printNumber(n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  if (base == 0)
+    return write((uint8_t)n);
+  return printNumber(n, base);
+}
+
+size_t Print::print(double n, int digits)
+{
+  return printFloat(n, digits);
+}
+
+size_t Print::println(void)
+{
+  return write("\r\n");
+}
+
+size_t Print::println(const __FlashStringHelper *s) { return print(s) + println(); }
+size_t Print::println(const char c[]) { return print(c) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(unsigned char b, int base) { return print(b, base) + println(); }
+size_t Print::println(int n, int base) { return print(n, base) + println(); }
+size_t Print::println(unsigned int n, int base) { return print(n, base) + println(); }
+size_t Print::println(long n, int base) { return print(n, base) + println(); }
+size_t Print::println(unsigned long n, int base) { return print(n, base) + println(); }
+size_t Print::println(double n, int digits) { return print(n, digits) + println(); }
+
+// upper case digits, as the core prints them
+size_t Print::printNumber(unsigned long n, uint8_t base)
+{
+  char buf[8 * sizeof(long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+
+  if (base < 2) base = 10;
+  *str = '\0';
+  do {
+    char c = n % base;
+    n /= base;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n);
+  return write(str);
+}
+
+size_t Print::printFloat(double number, uint8_t digits)
+{
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%.*f", digits, number);
+  return write(buf);
+}
+
+
+/**********************************
+ * Serial, SPI and EEPROM         *
+ **********************************/
+
+HostSerial Serial;
+SPIClass SPI;
+EEPROMClass EEPROM;
+
+int HostSerial::available()
+{
+  return ArduboyHost::serialIn.size();
+}
+
+int HostSerial::peek()
+{
+  return ArduboyHost::serialIn.empty() ? -1 : ArduboyHost::serialIn.front();
+}
+
+int HostSerial::read()
+{
+  if (ArduboyHost::serialIn.empty())
+    return -1;
+  uint8_t c = ArduboyHost::serialIn.front();
+  ArduboyHost::serialIn.pop_front();
+  return c;
+}
+
+size_t HostSerial::write(uint8_t c)
+{
+  ArduboyHost::serialOut += (char)c;
+  return 1;
+}
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+  ArduboyHost::spiTransfer(data);
+  return 0;
+}
+
+uint8_t eeprom_read_byte(const uint8_t *p)
+{
+  return ArduboyHost::eeprom[(uintptr_t)p % HOST_EEPROM_BYTES];
+}
+
+void eeprom_write_byte(uint8_t *p, uint8_t value)
+{
+  ArduboyHost::eeprom[(uintptr_t)p % HOST_EEPROM_BYTES] = value;
+}
+
+void eeprom_update_byte(uint8_t *p, uint8_t value)
+{
+  eeprom_write_byte(p, value);
+}
+
+
+/**********************************
+ * ArduboyHost                    *
+ **********************************/
+
+unsigned long ArduboyHost::now = 0;
+unsigned long ArduboyHost::callCost = 1;
+unsigned long ArduboyHost::stopAt = ~0UL;
+uint8_t ArduboyHost::sleepMode = SLEEP_MODE_IDLE;
+unsigned long ArduboyHost::ticks = 0;
+unsigned long ArduboyHost::sleeps = 0;
+uint8_t ArduboyHost::buttons = 0;
+bool ArduboyHost::captureSpi = true;
+std::vector<uint8_t> ArduboyHost::spi;
+unsigned long ArduboyHost::spiCommands = 0;
+unsigned long ArduboyHost::spiData = 0;
+uint8_t ArduboyHost::panel[HOST_PANEL_BYTES];
+bool ArduboyHost::panelOn = false;
+bool ArduboyHost::panelInverted = false;
+std::deque<uint8_t> ArduboyHost::serialIn;
+std::string ArduboyHost::serialOut;
+uint8_t ArduboyHost::eeprom[HOST_EEPROM_BYTES];
+uint8_t ArduboyHost::ram[HOST_FREE_RAM];
+unsigned long ArduboyHost::nextTick = HOST_TICK_US / 2;   // OCR0A is half way
+bool ArduboyHost::tickPending = false;
+bool ArduboyHost::pinPending = false;
+uint8_t ArduboyHost::isrDepth = 0;
+std::map<unsigned long, uint8_t> ArduboyHost::buttonQueue;
+
+// an erased EEPROM
+static struct EepromErase
+{
+  EepromErase() { memset(ArduboyHost::eeprom, 0xFF, sizeof(ArduboyHost::eeprom)); }
+} eeprom_erase;
+
+void ArduboyHost::run(void (*setup)(), void (*loop)(), unsigned long us)
+{
+  stopAt = us;
+  try {
+    setup();
+    for (;;)
+      loop();
+  }
+  catch (HostStop &) {
+  }
+}
+
+// Run an interrupt handler the way the CPU would: with interrupts off
+// until it returns
+void ArduboyHost::interrupt(void (*vector)())
+{
+  uint8_t oldSREG = SREG;
+  SREG &= ~_BV(SREG_I);
+  isrDepth++;
+  vector();
+  isrDepth--;
+  SREG = oldSREG;
+}
+
+void ArduboyHost::runPending()
+{
+  if (isrDepth || !(SREG & _BV(SREG_I)))
+    return;
+  if (pinPending) {
+    pinPending = false;
+    interrupt(PCINT0_vect);
+  }
+  if (tickPending) {
+    tickPending = false;
+    interrupt(TIMER0_COMPA_vect);
+  }
+}
+
+// the tick is stopped until the clock reaches us
+void ArduboyHost::skipTicks(unsigned long us)
+{
+  if (nextTick <= us)
+    nextTick += ((us - nextTick) / HOST_TICK_US + 1) * HOST_TICK_US;
+}
+
+// Move the clock on, running the interrupts it passes
+void ArduboyHost::advance(unsigned long us)
+{
+  unsigned long target = now + us;
+
+  runPending();
+  for (;;) {
+    bool tick = TIMSK0 & _BV(OCIE0A) && nextTick <= target;
+    bool press = !buttonQueue.empty() && buttonQueue.begin()->first <= target;
+    if (!tick && !press)
+      break;
+    if (press && (!tick || buttonQueue.begin()->first < nextTick)) {
+      now = max(now, buttonQueue.begin()->first);
+      applyButtons(buttonQueue.begin()->second);
+      buttonQueue.erase(buttonQueue.begin());
+    }
+    else {
+      now = max(now, nextTick);
+      nextTick += HOST_TICK_US;
+      ticks++;
+      tickPending = true;
+    }
+    runPending();
+  }
+  if (!(TIMSK0 & _BV(OCIE0A)))
+    skipTicks(target);
+  // a handler may have moved the clock on already
+  now = max(now, target);
+
+  if (!isrDepth && now >= stopAt)
+    throw HostStop();
+}
+
+// Sleep until the next interrupt.  Power down stops the system tick, so
+// only a button can end it.
+void ArduboyHost::sleep()
+{
+  unsigned long wake = stopAt;
+
+  sleeps++;
+  if (sleepMode != SLEEP_MODE_PWR_DOWN && TIMSK0 & _BV(OCIE0A))
+    wake = min(wake, nextTick);
+  if (!buttonQueue.empty())
+    wake = min(wake, buttonQueue.begin()->first);
+  if (sleepMode == SLEEP_MODE_PWR_DOWN)
+    skipTicks(wake);
+  advance(wake > now ? wake - now : 0);
+}
+
+void ArduboyHost::setButtons(uint8_t buttons)
+{
+  scheduleButtons(now, buttons);
+  advance(0);
+}
+
+void ArduboyHost::scheduleButtons(unsigned long at, uint8_t buttons)
+{
+  buttonQueue[at] = buttons;
+}
+
+// Drive the button pins low for the pressed buttons, and raise the pin
+// change interrupt when up, left or down changed
+void ArduboyHost::applyButtons(uint8_t pressed)
+{
+  uint8_t oldPINB = PINB;
+
+  buttons = pressed;
+  // down, left, up on PB6, PB5, PB4
+  PINB = (PINB & ~0x70) | (~pressed & 0x70);
+  // right on PC6
+  PINC = (PINC & ~0x40) | (pressed & 0x04 ? 0 : 0x40);
+  // A and B on PF7 and PF6
+  PINF = (PINF & ~0xC0) | ((uint8_t)~pressed << 6 & 0xC0);
+
+  if (PCICR & _BV(PCIE0) && (oldPINB ^ PINB) & PCMSK0)
+    pinPending = true;
+}
+
+// number of argument bytes after an SSD1306 command
+static uint8_t commandArgs(uint8_t c)
+{
+  switch (c) {
+    case 0x21: case 0x22:
+      return 2;
+    case 0x20: case 0x81: case 0x8D: case 0xA8: case 0xD3:
+    case 0xD5: case 0xD9: case 0xDA: case 0xDB:
+      return 1;
+  }
+  return 0;
+}
+
+// Keep the byte, and act on it as an SSD1306 in horizontal addressing
+// mode would: CS is pin 6 (PD7) and is active low, DC is pin 4 (PD4) and
+// is high for data
+void ArduboyHost::spiTransfer(uint8_t data)
+{
+  static uint8_t command, args, arg[2];
+  static uint8_t col = 0, col_start = 0, col_end = 127;
+  static uint8_t page = 0, page_start = 0, page_end = 7;
+
+  if (captureSpi)
+    spi.push_back(data);
+  if (PORTD & _BV(7))
+    return;
+
+  if (PORTD & _BV(4)) {
+    spiData++;
+    panel[page * 128 + col] = data;
+    if (col++ >= col_end) {
+      col = col_start;
+      if (page++ >= page_end)
+        page = page_start;
+    }
+    return;
+  }
+
+  spiCommands++;
+  if (args) {
+    arg[commandArgs(command) - args] = data;
+    if (--args)
+      return;
+    if (command == 0x21) {
+      col = col_start = arg[0] & 0x7F;
+      col_end = arg[1] & 0x7F;
+    }
+    else if (command == 0x22) {
+      page = page_start = arg[0] & 0x07;
+      page_end = arg[1] & 0x07;
+    }
+    return;
+  }
+  command = data;
+  args = commandArgs(data);
+  if (data == 0xAE) panelOn = false;
+  else if (data == 0xAF) panelOn = true;
+  else if (data == 0xA6) panelInverted = false;
+  else if (data == 0xA7) panelInverted = true;
+}
@@ -0,0 +1,81 @@
+#ifndef ArduboyHost_h
+#define ArduboyHost_h
+
+// The hardware behind the host stand-ins for the Arduino core.
+//
+// Time is virtual.  The clock only moves when the sources ask for it:
+// each millis() or micros() call moves it on by callCost, delay() by the
+// delay and sleeping to the next interrupt.  The system tick and the
+// button pin change interrupt run as the clock passes them, as they would
+// on the ATmega32u4, and not while interrupts are off.  Drawing takes no
+// time at all, so frame and push times say nothing about the real thing.
+//
+// The speaker timers (1 and 3) are set up but never run.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+// Timer0 overflows, worked out in 32 bits as TUNES_TICK_US is on the AVR
+#define HOST_TICK_US ((uint32_t)64 * 256 / (uint32_t)(F_CPU / 1000000UL))
+#define HOST_PANEL_BYTES 1024   // 128x64, a bit per pixel
+#define HOST_FREE_RAM 1024      // stand-in for the RAM between heap and stack
+#define HOST_EEPROM_BYTES 1024
+
+// thrown from the clock once it passes stopAt, to end run()
+struct HostStop { };
+
+class ArduboyHost
+{
+public:
+  // run setup() and then loop() until the clock reaches us
+  static void run(void (*setup)(), void (*loop)(), unsigned long us);
+
+  // Clock
+  static unsigned long now;       // us since reset
+  static unsigned long callCost;  // us each millis()/micros() call takes
+  static unsigned long stopAt;
+  static void advance(unsigned long us);
+  static void sleep();
+  static uint8_t sleepMode;
+  static unsigned long ticks;     // system ticks run
+  static unsigned long sleeps;
+
+  // Buttons, as the Arduboy's button masks
+  static void setButtons(uint8_t buttons);
+  static void scheduleButtons(unsigned long at, uint8_t buttons);
+  static uint8_t buttons;
+
+  // Display: the raw SPI stream and what an SSD1306 would show from it,
+  // in the same layout as the Arduboy's buffer
+  static void spiTransfer(uint8_t data);
+  static bool captureSpi;         // keep the stream in spi
+  static std::vector<uint8_t> spi;
+  static unsigned long spiCommands, spiData;
+  static uint8_t panel[HOST_PANEL_BYTES];
+  static bool panelOn, panelInverted;
+
+  // Serial: what the sketch reads, and what it has written
+  static std::deque<uint8_t> serialIn;
+  static std::string serialOut;
+
+  static uint8_t eeprom[HOST_EEPROM_BYTES];
+  static uint8_t ram[HOST_FREE_RAM];
+
+  // Interrupts
+  static void interrupt(void (*vector)());
+  static void runPending();
+
+private:
+  static void applyButtons(uint8_t buttons);
+  static void skipTicks(unsigned long us);
+  static unsigned long nextTick;
+  static bool tickPending, pinPending;
+  static uint8_t isrDepth;
+  static std::map<unsigned long, uint8_t> buttonQueue;
+};
+
+#endif
@@ -0,0 +1,3 @@
+// The sketch, built as C++ for the host.  The Arduino IDE adds prototypes
+// to a .ino before compiling it; ArduSketch.ino declares its own.
+#include "../ArduSketch.ino"
@@ -0,0 +1,132 @@
+#include "scheduler.h"
+#include "audio.h"
+#include "telemetry.h"
+
+// Add a task that first runs now and then every period us.  Returns its
+// id for the other calls, or SCHEDULER_MAX_TASKS if there is no room.
+uint8_t ArduboyScheduler::add(SchedulerTask run, unsigned long period)
+{
+  if (count == SCHEDULER_MAX_TASKS)
+    return SCHEDULER_MAX_TASKS;
+
+  ScheduledTask *t = &task_list[count];
+  memset(t, 0, sizeof(*t));
+  t->run = run;
+  t->period = period;
+  t->next = micros();
+  if (!count)
+    stats_start = t->next;
+  return count++;
+}
+
+// Run the task that has been due longest, if any, otherwise sleep until
+// the next system tick.  Call it from loop().
+//
+// Deadlines advance by whole periods, so a task keeps its rate however
+// long it takes to run.  A task that falls a period or more behind skips
+// the runs it missed instead of running back to back to catch up.
+void ArduboyScheduler::runNext()
+{
+  unsigned long now = micros();
+  ScheduledTask *due = NULL;
+  long late = 0;
+
+  for (uint8_t i = 0; i < count; i++) {
+    long l = now - task_list[i].next;
+    if (l >= 0 && (!due || l > late)) {  // ties go to the task added first
+      due = &task_list[i];
+      late = l;
+    }
+  }
+
+  if (!due) {
+    // Sleep even when a task falls due before the next tick, which then
+    // runs it up to a tick late.  Staying awake for it would spin through
+    // most of a short period, and all of one no longer than a tick.
+    sleeps++;
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
+    return;
+  }
+
+  due->next += due->period;
+  if (late >= (long)due->period) {
+    unsigned long missed = late / due->period;
+    due->next += missed * due->period;
+    due->skips += missed;
+  }
+  if ((unsigned long)late > due->jitter)
+    due->jitter = min((unsigned long)late, 0xFFFFUL);
+  due->runs++;
+  running = due;
+  run_start = now;
+  due->run();
+  due->busy += micros() - run_start;
+  running = NULL;
+}
+
+// Call after the CPU has slept outside the scheduler, as powerDown()
+// does, so the time asleep is not counted as skips, jitter or busy time.
+// The task that slept is next due a period from now and every other
+// task is due now, the way powerDown() restarts the frame timing.
+void ArduboyScheduler::wake()
+{
+  unsigned long now = micros();
+
+  for (uint8_t i = 0; i < count; i++)
+    task_list[i].next = &task_list[i] == running ? now + task_list[i].period : now;
+  run_start = now;
+}
+
+// Put the next run of a task us from now, instead of a period after the
+// last.  From inside the task this replaces the deadline just set.
+void ArduboyScheduler::delayTask(uint8_t id, unsigned long us)
+{
+  if (id < count)
+    task_list[id].next = micros() + us;
+}
+
+const ScheduledTask *ArduboyScheduler::task(uint8_t id)
+{
+  return id < count ? &task_list[id] : NULL;
+}
+
+// percentage of the time since the last clearStats() spent in a task
+uint8_t ArduboyScheduler::cpuLoad(uint8_t id)
+{
+  unsigned long span = (micros() - stats_start) / 100;
+  if (id >= count || !span)
+    return 0;
+  return min(task_list[id].busy / span, 100UL);
+}
+
+void ArduboyScheduler::clearStats()
+{
+  for (uint8_t i = 0; i < count; i++) {
+    task_list[i].busy = 0;
+    task_list[i].runs = 0;
+    task_list[i].skips = 0;
+    task_list[i].jitter = 0;
+  }
+  sleeps = 0;
+  stats_start = micros();
+}
+
+// Send the counters of every task in a TELEMETRY_TASKS frame, then clear
+// them so each frame covers the time since the last
+void ArduboyScheduler::statsSend(Print &out)
+{
+  uint8_t frame[2 + 7 * SCHEDULER_MAX_TASKS];
+  uint8_t *f = frame + 2;
+
+  memcpy(frame, &sleeps, 2);
+  for (uint8_t i = 0; i < count; i++) {
+    memcpy(f, &task_list[i].runs, 2);
+    memcpy(f + 2, &task_list[i].skips, 2);
+    memcpy(f + 4, &task_list[i].jitter, 2);
+    f[6] = cpuLoad(i);
+    f += 7;
+  }
+  telemetrySend(out, TELEMETRY_TASKS, frame, f - frame);
+  clearStats();
+}
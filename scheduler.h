@@ -0,0 +1,50 @@
+#ifndef ArduboyScheduler_h
+#define ArduboyScheduler_h
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+
+#define SCHEDULER_MAX_TASKS 4
+
+typedef void (*SchedulerTask)();
+
+// A task and what it has cost since it was added or clearStats()
+struct ScheduledTask
+{
+  SchedulerTask run;
+  unsigned long period;   // us between runs
+  unsigned long next;     // micros() when the next run is due
+  unsigned long busy;     // us spent running
+  uint16_t runs;          // times it was woken
+  uint16_t skips;         // runs missed because it was too late
+  uint16_t jitter;        // most us a run started after it was due
+};
+
+// Runs tasks at fixed periods from loop(), all timed by micros().  A task
+// runs to completion, so a long one delays the others; the delay shows up
+// as their jitter.  Between deadlines the CPU sleeps in idle, woken by the
+// system tick, so a task can run up to TUNES_TICK_US late; periods that
+// are multiples of it keep in step with the tick.
+class ArduboyScheduler
+{
+public:
+  uint8_t add(SchedulerTask run, unsigned long period);
+  void runNext();
+  void delayTask(uint8_t id, unsigned long us);
+  const ScheduledTask *task(uint8_t id);
+  uint8_t cpuLoad(uint8_t id);
+  void clearStats();
+  void statsSend(Print &out);
+  void wake();
+  uint8_t tasks() { return count; }
+  uint16_t sleeps = 0;    // times runNext() slept
+
+private:
+  ScheduledTask task_list[SCHEDULER_MAX_TASKS];
+  uint8_t count = 0;
+  unsigned long stats_start = 0;
+  ScheduledTask *running = NULL;
+  unsigned long run_start = 0;
+};
+
+#endif
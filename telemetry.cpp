@@ -0,0 +1,54 @@
+#include "telemetry.h"
+
+void telemetrySend(Print &out, uint8_t type, const void *payload, uint8_t length)
+{
+  const uint8_t *p = (const uint8_t *)payload;
+  uint8_t sum = type + length;
+
+  out.write(TELEMETRY_SYNC);
+  out.write(type);
+  out.write(length);
+  for (uint8_t i = 0; i < length; i++) {
+    out.write(p[i]);
+    sum += p[i];
+  }
+  out.write(sum);
+}
+
+#ifdef PROFILING
+// written by the interrupts for PROFILE_AUDIO, so read with them off
+static volatile ProfileCounter profile[PROFILE_PHASES];
+
+void profileAdd(uint8_t phase, unsigned long us)
+{
+  volatile ProfileCounter *c = &profile[phase];
+  uint16_t t = min(us, 0xFFFFUL);
+
+  if (!c->runs || t < c->min) c->min = t;
+  if (t > c->max) c->max = t;
+  c->total += t;
+  c->runs++;
+}
+
+// Send the counters since the last call in a TELEMETRY_PROFILE frame and
+// start them again.
+void profileSend(Print &out)
+{
+  uint16_t frame[PROFILE_PHASES * 4];
+  uint16_t *f = frame;
+
+  for (uint8_t i = 0; i < PROFILE_PHASES; i++) {
+    ProfileCounter c;
+    uint8_t oldSREG = SREG;
+    cli();
+    c = *(ProfileCounter *)&profile[i];
+    memset((void *)&profile[i], 0, sizeof(profile[i]));
+    SREG = oldSREG;
+    *f++ = c.runs;
+    *f++ = c.min;
+    *f++ = c.runs ? c.total / c.runs : 0;
+    *f++ = c.max;
+  }
+  telemetrySend(out, TELEMETRY_PROFILE, frame, sizeof(frame));
+}
+#endif
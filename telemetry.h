@@ -0,0 +1,64 @@
+#ifndef ArduboyTelemetry_h
+#define ArduboyTelemetry_h
+
+#include <Arduino.h>
+
+// Uncomment to time the phases below with micros() and let the sketch
+// send them over Serial, see tools/ardusketch-telemetry.cpp.  Without it
+// PROFILE() and the display byte counts in transfer() compile to nothing.
+// #define PROFILING
+
+// Phases timed by PROFILE().  They nest: logic includes the drawing and
+// the push it does, and every phase includes the interrupts that land in
+// it, audio among them.
+#define PROFILE_INPUT 0   // pollButtons()
+#define PROFILE_LOGIC 1   // a screen function
+#define PROFILE_DRAW 2    // drawing into sBuffer
+#define PROFILE_PUSH 3    // sending a frame to the display
+#define PROFILE_AUDIO 4   // the sequencer tick
+#define PROFILE_PHASES 5
+
+// A telemetry frame is TELEMETRY_SYNC, a type, the payload length, the
+// payload and the low byte of the sum of the type, length and payload.
+// Multi byte values are little endian.
+#define TELEMETRY_SYNC 0xA5
+#define TELEMETRY_PROFILE 0x01   // per phase: runs, min, avg, max us, u16 each
+#define TELEMETRY_BUS 0x02       // u32 data bytes, u32 commands, u16 pushes,
+                                 // u16 per push histogram bucket
+#define TELEMETRY_RAM 0x03       // u16 free now, u16 least free, u16 most stack
+#define TELEMETRY_WAKE 0x04      // u16 wakes from powerDown(), u16 latency us
+#define TELEMETRY_TASKS 0x05     // u16 sleeps, per task u16 runs, u16 skips,
+                                 // u16 jitter us, u8 CPU load %
+
+struct ProfileCounter
+{
+  uint16_t runs;
+  uint16_t min;
+  uint16_t max;
+  uint32_t total;
+};
+
+void telemetrySend(Print &out, uint8_t type, const void *payload, uint8_t length);
+
+#ifdef PROFILING
+void profileAdd(uint8_t phase, unsigned long us);
+void profileSend(Print &out);
+
+// times the rest of the enclosing block
+class ProfileScope
+{
+public:
+  ProfileScope(uint8_t phase) : phase(phase), start(micros()) { }
+  ~ProfileScope() { profileAdd(phase, micros() - start); }
+
+private:
+  uint8_t phase;
+  unsigned long start;
+};
+
+#define PROFILE(phase) ProfileScope profile_scope(phase)
+#else
+#define PROFILE(phase)
+#endif
+
+#endif
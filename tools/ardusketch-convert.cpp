@@ -0,0 +1,1162 @@
+/*********************************************************
+ *                                                       *
+ *                  ARDUSKETCH-CONVERT                   *
+ *                                                       *
+ *     Host side batch converter for ArduSketch art.     *
+ *                                                       *
+ *  decode: parses captured serial output (writeHex,     *
+ *          writeCode and writeSVG exports, including    *
+ *          animation sprite sheets) into PBM or PNG     *
+ *          files.                                       *
+ *  encode: converts 1-bit PBM/PNG images into page      *
+ *          ordered PROGMEM headers, byte compatible     *
+ *          with Arduboy::drawBitmap().                  *
+ *                                                       *
+ *  Files are processed in parallel on a thread pool and *
+ *  every input is streamed, so neither huge capture     *
+ *  logs nor large images are ever loaded whole.         *
+ *                                                       *
+ *  Build: g++ -std=c++17 -O2 -pthread                   *
+ *             -o ardusketch-convert ardusketch-convert.cpp
+ *********************************************************/
+
+/*
+ Usage:
+   ardusketch-convert decode [-j N] [-f pbm|png] [-o DIR] capture.log ...
+   ardusketch-convert encode [-j N] [-o DIR] [--invert] DIR|image ...
+
+ Images found under a DIR go to the same path under the output directory,
+ so walk/left.pbm becomes walk/left.h with the symbol walk_left.  Inputs
+ that would share an output file or a symbol are reported and skipped,
+ as are captures that share a name.
+
+ Pixel convention: a lit OLED pixel is white in PBM/PNG output, so the
+ images look like the screen.  --invert flips this when encoding art that
+ was drawn black on white.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**********************************
+ * Diagnostics                    *
+ **********************************/
+
+static std::mutex log_lock;
+static std::atomic<int> failures(0);
+
+static void fail(const std::string &file, const std::string &message)
+{
+  std::lock_guard<std::mutex> guard(log_lock);
+  std::cerr << "ardusketch-convert: " << file << ": " << message << "\n";
+  failures++;
+}
+
+static void note(const std::string &message)
+{
+  std::lock_guard<std::mutex> guard(log_lock);
+  std::cout << message << "\n";
+}
+
+/**********************************
+ * Thread Pool                    *
+ **********************************/
+
+// Fixed set of workers draining one job queue.  Jobs may submit further
+// jobs (the capture parser hands every decoded image off for writing).
+class ThreadPool
+{
+public:
+  explicit ThreadPool(unsigned count)
+  {
+    for (unsigned i = 0; i < count; i++) {
+      workers.emplace_back([this] { run(); });
+    }
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : workers) t.join();
+  }
+
+  void submit(std::function<void()> job)
+  {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      jobs.push(std::move(job));
+      pending++;
+    }
+    wake.notify_one();
+  }
+
+  // blocks until every submitted job (and the jobs they submit) finished
+  void wait()
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this] { return pending == 0; });
+  }
+
+private:
+  void run()
+  {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [this] { return stopping || !jobs.empty(); });
+        if (jobs.empty()) return;
+        job = std::move(jobs.front());
+        jobs.pop();
+      }
+      job();
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        if (--pending == 0) idle.notify_all();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> jobs;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  unsigned pending = 0;
+  bool stopping = false;
+};
+
+/**********************************
+ * Page Ordered Bitmaps           *
+ **********************************/
+
+// Same layout as sBuffer and drawBitmap(): (h+7)/8 pages of w bytes,
+// bit 0 of each byte is the top pixel of the page.
+struct Bitmap
+{
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> data;
+
+  Bitmap() { }
+  Bitmap(int w, int h) : width(w), height(h), data(w * ((h + 7) / 8), 0) { }
+
+  int pages() const { return (height + 7) / 8; }
+
+  bool get(int x, int y) const
+  {
+    return data[(y / 8) * width + x] & (1 << (y % 8));
+  }
+
+  void set(int x, int y)
+  {
+    data[(y / 8) * width + x] |= 1 << (y % 8);
+  }
+};
+
+/**********************************
+ * PBM / PNG Writers              *
+ **********************************/
+
+static uint32_t crc_table[256];
+
+static void initCrcTable()
+{
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    }
+    crc_table[n] = c;
+  }
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc = crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static void put32(std::vector<uint8_t> &out, uint32_t v)
+{
+  out.push_back(v >> 24);
+  out.push_back(v >> 16);
+  out.push_back(v >> 8);
+  out.push_back(v);
+}
+
+static void pngChunk(std::ostream &out, const char *type, const std::vector<uint8_t> &body)
+{
+  std::vector<uint8_t> chunk;
+  put32(chunk, body.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), body.begin(), body.end());
+  put32(chunk, crc32(0, chunk.data() + 4, chunk.size() - 4));
+  out.write((const char *)chunk.data(), chunk.size());
+}
+
+// Rows of a 1-bit image, MSB first, 1 = white.
+static std::vector<uint8_t> packRow(const Bitmap &bmp, int y)
+{
+  std::vector<uint8_t> row((bmp.width + 7) / 8, 0);
+  for (int x = 0; x < bmp.width; x++) {
+    if (bmp.get(x, y)) row[x / 8] |= 0x80 >> (x % 8);
+  }
+  return row;
+}
+
+static void writePBM(const Bitmap &bmp, const fs::path &path)
+{
+  std::ofstream out(path, std::ios::binary);
+  out << "P4\n" << bmp.width << " " << bmp.height << "\n";
+  for (int y = 0; y < bmp.height; y++) {
+    // PBM 1 is black, a lit pixel is white
+    std::vector<uint8_t> row = packRow(bmp, y);
+    for (uint8_t &b : row) b = ~b;
+    if (bmp.width % 8) row.back() &= 0xff << (8 - bmp.width % 8);
+    out.write((const char *)row.data(), row.size());
+  }
+  if (!out) throw std::runtime_error("write failed");
+}
+
+// 1-bit grayscale PNG.  Sprites are tiny so the image data goes out as
+// stored (uncompressed) deflate blocks and needs no zlib.
+static void writePNG(const Bitmap &bmp, const fs::path &path)
+{
+  std::ofstream out(path, std::ios::binary);
+  static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  out.write((const char *)signature, sizeof(signature));
+
+  std::vector<uint8_t> ihdr;
+  put32(ihdr, bmp.width);
+  put32(ihdr, bmp.height);
+  ihdr.push_back(1);  // bit depth
+  ihdr.push_back(0);  // grayscale
+  ihdr.push_back(0);  // deflate
+  ihdr.push_back(0);  // adaptive filtering
+  ihdr.push_back(0);  // no interlace
+  pngChunk(out, "IHDR", ihdr);
+
+  std::vector<uint8_t> raw;
+  for (int y = 0; y < bmp.height; y++) {
+    std::vector<uint8_t> row = packRow(bmp, y);
+    raw.push_back(0);  // filter: none
+    raw.insert(raw.end(), row.begin(), row.end());
+  }
+
+  std::vector<uint8_t> z = { 0x78, 0x01 };
+  uint32_t a = 1, b = 0;
+  for (uint8_t c : raw) {
+    a = (a + c) % 65521;
+    b = (b + a) % 65521;
+  }
+  size_t pos = 0;
+  do {
+    size_t len = std::min<size_t>(raw.size() - pos, 65535);
+    bool last = pos + len == raw.size();
+    z.push_back(last ? 1 : 0);
+    z.push_back(len & 0xff);
+    z.push_back(len >> 8);
+    z.push_back(~len & 0xff);
+    z.push_back((~len >> 8) & 0xff);
+    z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + len);
+    pos += len;
+  } while (pos < raw.size());
+  put32(z, (b << 16) | a);
+  pngChunk(out, "IDAT", z);
+  pngChunk(out, "IEND", {});
+  if (!out) throw std::runtime_error("write failed");
+}
+
+/**********************************
+ * Capture Parsing (decode)       *
+ **********************************/
+
+static int hexValue(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static bool validWidth(int w)
+{
+  return w == 8 || w == 16 || w == 32 || w == 64 || w == 128;
+}
+
+// writeCode() prints no dimensions, the canvas is implied by the byte count
+static bool sizeFromCount(size_t count, int &w, int &h)
+{
+  switch (count) {
+    case 8:    w = 8;   h = 8;  return true;
+    case 32:   w = 16;  h = 16; return true;
+    case 128:  w = 32;  h = 32; return true;
+    case 512:  w = 64;  h = 64; return true;
+    case 1024: w = 128; h = 64; return true;
+  }
+  return false;
+}
+
+static bool attrInt(const std::string &text, const char *name, int &value)
+{
+  std::string key = std::string(" ") + name + "=\"";
+  size_t at = text.find(key);
+  if (at == std::string::npos) return false;
+  value = std::atoi(text.c_str() + at + key.size());
+  return true;
+}
+
+// Line driven state machine over a capture.  Only the image currently
+// being received is held in memory; finished images go to `emit`.
+class CaptureParser
+{
+public:
+  CaptureParser(const std::string &name, std::function<void(Bitmap)> emit)
+    : name(name), emit(emit) { }
+
+  void line(std::string text)
+  {
+    lineno++;
+    while (!text.empty()) {
+      switch (state) {
+        case IDLE:  text = idle(text); break;
+        case CODE:  text = code(text); break;
+        case HEX:   text = hex(text); break;
+        case SVG:   text = svg(text); break;
+      }
+    }
+  }
+
+  void finish()
+  {
+    if (state != IDLE) {
+      fail(name, "capture ends inside an export started on line " + std::to_string(start_line));
+    }
+    state = IDLE;
+  }
+
+private:
+  enum State { IDLE, CODE, HEX, SVG };
+
+  std::string idle(const std::string &text)
+  {
+    size_t at;
+    if ((at = text.find("<svg")) != std::string::npos) {
+      int w = 0, h = 0;
+      attrInt(text, "width", w);
+      attrInt(text, "height", h);
+      w = (w - 1) / 5;
+      h = (h - 1) / 5;
+      if (w <= 0 || h <= 0 || w > 128 || h > 64) {
+        fail(name, "line " + std::to_string(lineno) + ": bad svg size");
+        return "";
+      }
+      begin(SVG, w, h);
+      size_t end = text.find('>', at);
+      return end == std::string::npos ? "" : text.substr(end + 1);
+    }
+    // writeCode() of an animation announces the frame size first
+    if ((at = text.find("// sprite sheet:")) != std::string::npos) {
+      int frames, w, h;
+      if (std::sscanf(text.c_str() + at, "// sprite sheet: %d frames of %dx%d", &frames, &w, &h) == 3) {
+        sheet_width = w;
+        sheet_height = h * frames;
+      }
+      return "";
+    }
+    if ((at = text.find("PROGMEM")) != std::string::npos) {
+      begin(CODE, sheet_width, sheet_height);
+      sheet_width = sheet_height = 0;
+      return text.substr(at + 7);
+    }
+    // writeHex() header: width and height as two bytes on their own line
+    std::string t = trim(text);
+    if (t.size() == 4 && std::all_of(t.begin(), t.end(), [](char c) { return hexValue(c) >= 0; })) {
+      int w = hexValue(t[0]) * 16 + hexValue(t[1]);
+      int h = hexValue(t[2]) * 16 + hexValue(t[3]);
+      if (validWidth(w) && h > 0 && h <= 64) {
+        begin(HEX, w, h);
+      }
+    }
+    return "";
+  }
+
+  std::string code(const std::string &text)
+  {
+    size_t end = text.find("};");
+    std::string body = text.substr(0, end);
+    for (size_t at = body.find("0x"); at != std::string::npos; at = body.find("0x", at + 2)) {
+      int hi = at + 2 < body.size() ? hexValue(body[at + 2]) : -1;
+      int lo = at + 3 < body.size() ? hexValue(body[at + 3]) : -1;
+      if (hi < 0 || lo < 0) continue;
+      bytes.push_back(hi * 16 + lo);
+    }
+    if (end == std::string::npos) return "";
+
+    int w = width, h = height;
+    if ((w && bytes.size() == expected) || (!w && sizeFromCount(bytes.size(), w, h))) {
+      Bitmap bmp(w, h);
+      bmp.data = bytes;
+      emit(std::move(bmp));
+    }
+    else {
+      fail(name, "line " + std::to_string(start_line) + ": writeCode export has " +
+           std::to_string(bytes.size()) + " bytes, no canvas matches");
+    }
+    state = IDLE;
+    return text.substr(end + 2);
+  }
+
+  std::string hex(const std::string &text)
+  {
+    std::string t = trim(text);
+    if (t.empty()) return "";
+    for (char c : t) {
+      if (hexValue(c) < 0) {
+        fail(name, "line " + std::to_string(lineno) + ": writeHex export truncated after " +
+             std::to_string(bytes.size()) + " bytes");
+        state = IDLE;
+        return text;
+      }
+    }
+    for (size_t i = 0; i + 1 < t.size() && bytes.size() < expected; i += 2) {
+      bytes.push_back(hexValue(t[i]) * 16 + hexValue(t[i + 1]));
+    }
+    if (bytes.size() == expected) {
+      Bitmap bmp(width, height);
+      bmp.data = bytes;
+      emit(std::move(bmp));
+      state = IDLE;
+    }
+    return "";
+  }
+
+  std::string svg(const std::string &text)
+  {
+    size_t end = text.find("</svg>");
+    std::string body = text.substr(0, end);
+    int x, y;
+    // the background rect carries no position and is skipped
+    if (body.find("<rect") != std::string::npos && attrInt(body, "x", x) && attrInt(body, "y", y)) {
+      x = (x - 1) / 5;
+      y = (y - 1) / 5;
+      if (x >= 0 && x < svg_bmp.width && y >= 0 && y < svg_bmp.height) svg_bmp.set(x, y);
+    }
+    if (end == std::string::npos) return "";
+    emit(std::move(svg_bmp));
+    state = IDLE;
+    return text.substr(end + 6);
+  }
+
+  void begin(State s, int w, int h)
+  {
+    state = s;
+    start_line = lineno;
+    width = w;
+    height = h;
+    expected = w * ((h + 7) / 8);
+    bytes.clear();
+    if (s == SVG) svg_bmp = Bitmap(w, h);
+  }
+
+  static std::string trim(const std::string &text)
+  {
+    size_t a = text.find_first_not_of(" \t\r\n");
+    if (a == std::string::npos) return "";
+    size_t b = text.find_last_not_of(" \t\r\n");
+    return text.substr(a, b - a + 1);
+  }
+
+  std::string name;
+  std::function<void(Bitmap)> emit;
+  State state = IDLE;
+  size_t lineno = 0;
+  size_t start_line = 0;
+  int width = 0;
+  int height = 0;
+  int sheet_width = 0;
+  int sheet_height = 0;
+  size_t expected = 0;
+  std::vector<uint8_t> bytes;
+  Bitmap svg_bmp;
+};
+
+/**********************************
+ * Image Reading (encode)         *
+ **********************************/
+
+// Receives decoded rows one at a time (1 = lit) and turns every eight of
+// them into one page, so only a single page is ever buffered.
+class PageSink
+{
+public:
+  virtual ~PageSink() { }
+  virtual void begin(int width, int height) = 0;
+  virtual void row(const std::vector<uint8_t> &lit) = 0;
+  virtual void end() = 0;
+};
+
+class HeaderWriter : public PageSink
+{
+public:
+  HeaderWriter(std::ostream &out, const std::string &symbol, const std::string &source)
+    : out(out), symbol(symbol), source(source) { }
+
+  void begin(int w, int h) override
+  {
+    width = w;
+    height = h;
+    page.assign(w, 0);
+    out << "// " << source << " (" << w << "x" << h << ")\n";
+    out << "#define " << upper(symbol) << "_WIDTH " << w << "\n";
+    out << "#define " << upper(symbol) << "_HEIGHT " << h << "\n\n";
+    out << "const static unsigned char " << symbol << "[] PROGMEM =\n{";
+  }
+
+  void row(const std::vector<uint8_t> &lit) override
+  {
+    for (int x = 0; x < width; x++) {
+      if (lit[x]) page[x] |= 1 << (y % 8);
+    }
+    y++;
+    if (y % 8 == 0 || y == height) flush();
+  }
+
+  void end() override
+  {
+    out << "\n};\n";
+  }
+
+private:
+  void flush()
+  {
+    for (int x = 0; x < width; x++) {
+      if ((count & 7) == 0) out << "\n  ";
+      char hex[8];
+      std::snprintf(hex, sizeof(hex), "0x%02X", page[x]);
+      out << hex;
+      if (++count != (size_t)width * ((height + 7) / 8)) out << ", ";
+    }
+    std::fill(page.begin(), page.end(), 0);
+  }
+
+  static std::string upper(std::string s)
+  {
+    for (char &c : s) c = std::toupper((unsigned char)c);
+    return s;
+  }
+
+  std::ostream &out;
+  std::string symbol;
+  std::string source;
+  int width = 0;
+  int height = 0;
+  int y = 0;
+  size_t count = 0;
+  std::vector<uint8_t> page;
+};
+
+static void pbmToken(std::istream &in, std::string &token)
+{
+  token.clear();
+  int c;
+  while ((c = in.get()) != EOF) {
+    if (c == '#') {
+      while ((c = in.get()) != EOF && c != '\n') { }
+    }
+    else if (!std::isspace(c)) {
+      token.push_back(c);
+      break;
+    }
+  }
+  while ((c = in.peek()) != EOF && !std::isspace(c) && c != '#') token.push_back(in.get());
+}
+
+static void readPBM(std::istream &in, PageSink &sink, bool invert)
+{
+  std::string magic, w, h;
+  pbmToken(in, magic);
+  pbmToken(in, w);
+  pbmToken(in, h);
+  int width = std::atoi(w.c_str());
+  int height = std::atoi(h.c_str());
+  if ((magic != "P1" && magic != "P4") || width <= 0 || height <= 0) {
+    throw std::runtime_error("not a PBM image");
+  }
+  in.get();  // single whitespace before raster
+
+  sink.begin(width, height);
+  std::vector<uint8_t> lit(width);
+  std::vector<uint8_t> packed((width + 7) / 8);
+  for (int y = 0; y < height; y++) {
+    if (magic == "P4") {
+      in.read((char *)packed.data(), packed.size());
+      if (!in) throw std::runtime_error("raster truncated");
+      for (int x = 0; x < width; x++) lit[x] = !(packed[x / 8] & (0x80 >> (x % 8)));
+    }
+    else {
+      for (int x = 0; x < width; x++) {
+        int c;
+        while ((c = in.get()) != EOF && c != '0' && c != '1') { }
+        if (c == EOF) throw std::runtime_error("raster truncated");
+        lit[x] = c == '0';
+      }
+    }
+    if (invert) for (uint8_t &p : lit) p = !p;
+    sink.row(lit);
+  }
+  sink.end();
+}
+
+// Streaming PNG decoder: IDAT bytes are pulled on demand by a small
+// inflater that keeps only the 32K deflate window, and scanlines are
+// unfiltered against the previous one and handed straight to the sink.
+class PngReader
+{
+public:
+  PngReader(std::istream &in, PageSink &sink, bool invert) : in(in), sink(sink), invert(invert) { }
+
+  void read()
+  {
+    uint8_t signature[8];
+    in.read((char *)signature, 8);
+    if (!in || std::memcmp(signature, "\x89PNG\r\n\x1a\n", 8) != 0) {
+      throw std::runtime_error("not a PNG image");
+    }
+    header();
+    sink.begin(width, height);
+    inflate();
+    if (y != height) throw std::runtime_error("image data truncated");
+    sink.end();
+  }
+
+private:
+  uint32_t get32()
+  {
+    uint8_t b[4];
+    in.read((char *)b, 4);
+    if (!in) throw std::runtime_error("file truncated");
+    return ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+  }
+
+  void header()
+  {
+    uint32_t len = get32();
+    char type[4];
+    in.read(type, 4);
+    if (len != 13 || std::memcmp(type, "IHDR", 4) != 0) throw std::runtime_error("missing IHDR");
+    width = get32();
+    height = get32();
+    uint8_t rest[5];
+    in.read((char *)rest, 5);
+    get32();  // crc
+    depth = rest[0];
+    color = rest[1];
+    if (rest[4] != 0) throw std::runtime_error("interlaced PNG not supported");
+    if (width <= 0 || height <= 0) throw std::runtime_error("bad dimensions");
+
+    static const int channels_for[] = { 1, 0, 3, 1, 2, 0, 4 };
+    channels = color <= 6 ? channels_for[color] : 0;
+    if (!channels) throw std::runtime_error("bad color type");
+    bpp = std::max(1, channels * depth / 8);
+    stride = (width * channels * depth + 7) / 8;
+    line.assign(stride + 1, 0);
+    prev.assign(stride, 0);
+    lit.assign(width, 0);
+  }
+
+  // next byte of zlib data, crossing IDAT chunk boundaries
+  int nextByte()
+  {
+    while (chunk_left == 0) {
+      if (in_idat) get32();  // crc of previous IDAT
+      uint32_t len = get32();
+      char type[4];
+      in.read(type, 4);
+      if (!in) throw std::runtime_error("file truncated");
+      if (std::memcmp(type, "IDAT", 4) == 0) {
+        chunk_left = len;
+        in_idat = true;
+        continue;
+      }
+      if (std::memcmp(type, "IEND", 4) == 0) throw std::runtime_error("image data truncated");
+      if (std::memcmp(type, "PLTE", 4) == 0) {
+        palette.resize(len / 3);
+        for (auto &p : palette) {
+          uint8_t rgb[3];
+          in.read((char *)rgb, 3);
+          p = (rgb[0] * 299 + rgb[1] * 587 + rgb[2] * 114) / 1000;
+        }
+        in.ignore(len % 3);
+      }
+      else if (std::memcmp(type, "tRNS", 4) == 0 && color == 3) {
+        palette_alpha.resize(len);
+        in.read((char *)palette_alpha.data(), len);
+      }
+      else {
+        in.ignore(len);
+      }
+      get32();
+      in_idat = false;
+    }
+    chunk_left--;
+    int c = in.get();
+    if (c == EOF) throw std::runtime_error("file truncated");
+    return c;
+  }
+
+  int bits(int need)
+  {
+    while (bit_count < need) {
+      bit_buf |= (uint32_t)nextByte() << bit_count;
+      bit_count += 8;
+    }
+    int v = bit_buf & ((1u << need) - 1);
+    bit_buf >>= need;
+    bit_count -= need;
+    return v;
+  }
+
+  void output(uint8_t b)
+  {
+    window[window_pos++ & 0x7fff] = b;
+    if (y >= height) return;
+    line[line_pos++] = b;
+    if (line_pos == line.size()) scanline();
+  }
+
+  struct Huffman
+  {
+    short count[16];
+    short symbol[320];
+  };
+
+  static void build(Huffman &h, const uint8_t *lengths, int n)
+  {
+    short offs[16];
+    std::memset(h.count, 0, sizeof(h.count));
+    for (int i = 0; i < n; i++) h.count[lengths[i]]++;
+    h.count[0] = 0;
+    offs[1] = 0;
+    for (int i = 1; i < 15; i++) offs[i + 1] = offs[i] + h.count[i];
+    for (int i = 0; i < n; i++) {
+      if (lengths[i]) h.symbol[offs[lengths[i]]++] = i;
+    }
+  }
+
+  int decode(const Huffman &h)
+  {
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; len++) {
+      code |= bits(1);
+      int count = h.count[len];
+      if (code - count < first) return h.symbol[index + (code - first)];
+      index += count;
+      first += count;
+      first <<= 1;
+      code <<= 1;
+    }
+    throw std::runtime_error("corrupt deflate stream");
+  }
+
+  void codes(const Huffman &lencode, const Huffman &distcode)
+  {
+    static const short lbase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                   35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const short lext[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const short dbase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                   257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                   8193, 12289, 16385, 24577 };
+    static const short dext[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    while (true) {
+      int symbol = decode(lencode);
+      if (symbol < 256) {
+        output(symbol);
+      }
+      else if (symbol == 256) {
+        return;
+      }
+      else {
+        symbol -= 257;
+        if (symbol >= 29) throw std::runtime_error("corrupt deflate stream");
+        int len = lbase[symbol] + bits(lext[symbol]);
+        int dsym = decode(distcode);
+        if (dsym >= 30) throw std::runtime_error("corrupt deflate stream");
+        uint32_t dist = dbase[dsym] + bits(dext[dsym]);
+        if (dist > window_pos) throw std::runtime_error("corrupt deflate stream");
+        while (len--) output(window[(window_pos - dist) & 0x7fff]);
+      }
+    }
+  }
+
+  void fixedBlock()
+  {
+    uint8_t lengths[320];
+    int i = 0;
+    for (; i < 144; i++) lengths[i] = 8;
+    for (; i < 256; i++) lengths[i] = 9;
+    for (; i < 280; i++) lengths[i] = 7;
+    for (; i < 288; i++) lengths[i] = 8;
+    Huffman lencode, distcode;
+    build(lencode, lengths, 288);
+    for (i = 0; i < 30; i++) lengths[i] = 5;
+    build(distcode, lengths, 30);
+    codes(lencode, distcode);
+  }
+
+  void dynamicBlock()
+  {
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    uint8_t lengths[320];
+    int nlen = bits(5) + 257;
+    int ndist = bits(5) + 1;
+    int ncode = bits(4) + 4;
+    if (nlen > 286 || ndist > 30) throw std::runtime_error("corrupt deflate stream");
+    std::memset(lengths, 0, sizeof(lengths));
+    for (int i = 0; i < ncode; i++) lengths[order[i]] = bits(3);
+    Huffman lencode, distcode;
+    build(lencode, lengths, 19);
+
+    int index = 0;
+    while (index < nlen + ndist) {
+      int symbol = decode(lencode);
+      if (symbol < 16) {
+        lengths[index++] = symbol;
+        continue;
+      }
+      int len = 0, repeat;
+      if (symbol == 16) {
+        if (index == 0) throw std::runtime_error("corrupt deflate stream");
+        len = lengths[index - 1];
+        repeat = 3 + bits(2);
+      }
+      else if (symbol == 17) {
+        repeat = 3 + bits(3);
+      }
+      else {
+        repeat = 11 + bits(7);
+      }
+      if (index + repeat > nlen + ndist) throw std::runtime_error("corrupt deflate stream");
+      while (repeat--) lengths[index++] = len;
+    }
+    build(lencode, lengths, nlen);
+    build(distcode, lengths + nlen, ndist);
+    codes(lencode, distcode);
+  }
+
+  void inflate()
+  {
+    nextByte();  // zlib CMF
+    nextByte();  // zlib FLG
+    int last;
+    do {
+      last = bits(1);
+      int type = bits(2);
+      if (type == 0) {
+        bit_buf = 0;
+        bit_count = 0;
+        int len = nextByte() | (nextByte() << 8);
+        nextByte();
+        nextByte();
+        while (len--) output(nextByte());
+      }
+      else if (type == 1) {
+        fixedBlock();
+      }
+      else if (type == 2) {
+        dynamicBlock();
+      }
+      else {
+        throw std::runtime_error("corrupt deflate stream");
+      }
+    } while (!last && y < height);
+  }
+
+  static uint8_t paeth(int a, int b, int c)
+  {
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+  }
+
+  int sample(const uint8_t *raw, int index) const
+  {
+    if (depth == 8) return raw[index];
+    if (depth == 16) return raw[index * 2];
+    int per_byte = 8 / depth;
+    int shift = 8 - depth * (index % per_byte + 1);
+    return (raw[index / per_byte] >> shift) & ((1 << depth) - 1);
+  }
+
+  void scanline()
+  {
+    uint8_t filter = line[0];
+    uint8_t *cur = line.data() + 1;
+    for (int i = 0; i < stride; i++) {
+      int a = i >= bpp ? cur[i - bpp] : 0;
+      int b = prev[i];
+      int c = i >= bpp ? prev[i - bpp] : 0;
+      switch (filter) {
+        case 0: break;
+        case 1: cur[i] += a; break;
+        case 2: cur[i] += b; break;
+        case 3: cur[i] += (a + b) / 2; break;
+        case 4: cur[i] += paeth(a, b, c); break;
+        default: throw std::runtime_error("bad scanline filter");
+      }
+    }
+
+    int max = depth == 16 ? 255 : (1 << depth) - 1;
+    for (int x = 0; x < width; x++) {
+      int luma, alpha = max;
+      if (color == 3) {
+        int index = sample(cur, x);
+        luma = index < (int)palette.size() ? palette[index] : 0;
+        alpha = index < (int)palette_alpha.size() ? palette_alpha[index] : 255;
+        max = 255;
+      }
+      else if (color == 2 || color == 6) {
+        luma = (sample(cur, x * channels) * 299 + sample(cur, x * channels + 1) * 587 +
+                sample(cur, x * channels + 2) * 114) / 1000;
+        if (color == 6) alpha = sample(cur, x * channels + 3);
+      }
+      else {
+        luma = sample(cur, x * channels);
+        if (color == 4) alpha = sample(cur, x * channels + 1);
+      }
+      bool on = luma * 2 > max && alpha * 2 > max;
+      lit[x] = invert ? !on && alpha * 2 > max : on;
+    }
+    sink.row(lit);
+
+    std::copy(cur, cur + stride, prev.begin());
+    line_pos = 0;
+    y++;
+  }
+
+  std::istream &in;
+  PageSink &sink;
+  bool invert;
+  int width = 0, height = 0, depth = 0, color = 0, channels = 0, bpp = 0, stride = 0;
+  int y = 0;
+  std::vector<uint8_t> palette, palette_alpha;
+  std::vector<uint8_t> line, prev, lit;
+  size_t line_pos = 0;
+  uint32_t chunk_left = 0;
+  bool in_idat = false;
+  uint32_t bit_buf = 0;
+  int bit_count = 0;
+  uint8_t window[32768];
+  uint32_t window_pos = 0;
+};
+
+/**********************************
+ * Jobs                           *
+ **********************************/
+
+struct Options
+{
+  std::string mode;
+  std::string format = "pbm";
+  fs::path out_dir = ".";
+  bool invert = false;
+  unsigned jobs = 0;
+  std::vector<fs::path> inputs;
+};
+
+// Where an image's header goes under the output directory: its path
+// under the directory given, or its name alone for an image given itself
+static fs::path headerFor(const fs::path &root, const fs::path &path)
+{
+  fs::path rel = root.empty() ? path.filename() : path.lexically_relative(root);
+  return rel.replace_extension(".h");
+}
+
+// the header's path without .h, made into a C identifier
+static std::string symbolFor(const fs::path &header)
+{
+  std::string s = (header.parent_path() / header.stem()).generic_string();
+  for (char &c : s) {
+    if (!std::isalnum((unsigned char)c)) c = '_';
+  }
+  if (s.empty() || std::isdigit((unsigned char)s[0])) s = "img_" + s;
+  return s;
+}
+
+static void decodeCapture(ThreadPool &pool, const Options &opt, const fs::path &path)
+{
+  std::ifstream in(path);
+  if (!in) {
+    fail(path.string(), "cannot open");
+    return;
+  }
+  std::string stem = path.stem().string();
+  unsigned index = 0;
+  CaptureParser parser(path.string(), [&](Bitmap bmp) {
+    char suffix[16];
+    std::snprintf(suffix, sizeof(suffix), "-%03u.", index++);
+    fs::path out = opt.out_dir / (stem + suffix + opt.format);
+    bool png = opt.format == "png";
+    pool.submit([bmp = std::move(bmp), out, png] {
+      try {
+        if (png) writePNG(bmp, out);
+        else writePBM(bmp, out);
+        note(out.string() + " (" + std::to_string(bmp.width) + "x" + std::to_string(bmp.height) + ")");
+      }
+      catch (const std::exception &e) {
+        fail(out.string(), e.what());
+      }
+    });
+  });
+
+  std::string text;
+  while (std::getline(in, text)) parser.line(text);
+  parser.finish();
+  if (index == 0) fail(path.string(), "no exports found");
+}
+
+static void encodeImage(const Options &opt, const fs::path &path, const fs::path &out_path,
+                        const std::string &symbol)
+{
+  try {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("cannot open");
+    std::ofstream out(out_path);
+    HeaderWriter header(out, symbol, path.filename().string());
+    if (in.peek() == 0x89) {
+      std::unique_ptr<PngReader> png(new PngReader(in, header, opt.invert));
+      png->read();
+    }
+    else {
+      readPBM(in, header, opt.invert);
+    }
+    if (!out) throw std::runtime_error("cannot write " + out_path.string());
+    note(out_path.string());
+  }
+  catch (const std::exception &e) {
+    fail(path.string(), e.what());
+    std::error_code ignored;
+    fs::remove(out_path, ignored);
+  }
+}
+
+static bool isImage(const fs::path &path)
+{
+  std::string ext = path.extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  return ext == ".pbm" || ext == ".png";
+}
+
+static void usage()
+{
+  std::cerr <<
+    "usage: ardusketch-convert decode [-j N] [-f pbm|png] [-o DIR] capture ...\n"
+    "       ardusketch-convert encode [-j N] [-o DIR] [--invert] DIR|image ...\n";
+  std::exit(2);
+}
+
+static Options parseArgs(int argc, char **argv)
+{
+  Options opt;
+  if (argc < 2) usage();
+  opt.mode = argv[1];
+  if (opt.mode != "decode" && opt.mode != "encode") usage();
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-j" && i + 1 < argc) opt.jobs = std::atoi(argv[++i]);
+    else if (arg == "-o" && i + 1 < argc) opt.out_dir = argv[++i];
+    else if (arg == "-f" && i + 1 < argc) opt.format = argv[++i];
+    else if (arg == "--invert") opt.invert = true;
+    else if (!arg.empty() && arg[0] == '-') usage();
+    else opt.inputs.push_back(arg);
+  }
+  if (opt.inputs.empty() || (opt.format != "pbm" && opt.format != "png")) usage();
+  if (opt.jobs == 0) opt.jobs = std::max(1u, std::thread::hardware_concurrency());
+  return opt;
+}
+
+int main(int argc, char **argv)
+{
+  Options opt = parseArgs(argc, argv);
+  initCrcTable();
+  fs::create_directories(opt.out_dir);
+
+  {
+    ThreadPool pool(opt.jobs);
+    // outputs are claimed here, before any job runs, so no two jobs can
+    // write the same file
+    std::set<fs::path> outputs;
+    std::set<std::string> symbols;
+
+    auto queueImage = [&](const fs::path &root, const fs::path &file) {
+      fs::path header = headerFor(root, file);
+      fs::path out = (opt.out_dir / header).lexically_normal();
+      std::string symbol = symbolFor(header);
+      if (!outputs.insert(out).second) {
+        fail(file.string(), "skipped, another input also writes " + out.string());
+        return;
+      }
+      if (!symbols.insert(symbol).second) {
+        fail(file.string(), "skipped, another input also has the symbol " + symbol);
+        return;
+      }
+      std::error_code error;
+      fs::create_directories(out.parent_path(), error);
+      pool.submit([&opt, file, out, symbol] { encodeImage(opt, file, out, symbol); });
+    };
+
+    for (const fs::path &input : opt.inputs) {
+      if (opt.mode == "decode") {
+        if (!outputs.insert(input.stem()).second) {
+          fail(input.string(), "skipped, another capture has the same name");
+          continue;
+        }
+        pool.submit([&pool, &opt, input] { decodeCapture(pool, opt, input); });
+      }
+      else if (fs::is_directory(input)) {
+        for (const fs::directory_entry &entry : fs::recursive_directory_iterator(input)) {
+          if (entry.is_regular_file() && isImage(entry.path()))
+            queueImage(input, entry.path());
+        }
+      }
+      else {
+        queueImage(fs::path(), input);
+      }
+    }
+    pool.wait();
+  }
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,647 @@
+/*********************************************************
+ *                                                       *
+ *                   ARDUSKETCH-SCORE                    *
+ *                                                       *
+ *   Host side compiler from standard MIDI files to the  *
+ *   score bytecode played by ArduboyTunes::step().      *
+ *                                                       *
+ *  compile: allocates MIDI notes to the tune channels,  *
+ *           drops redundant stop/play commands, merges  *
+ *           waits and writes a PROGMEM array.           *
+ *  decode:  prints the timeline of a score array.       *
+ *  verify:  compiles, decodes the bytecode again and    *
+ *           checks it sounds the same as the channel    *
+ *           allocation, against a naive conversion.     *
+ *                                                       *
+ *  Build: g++ -std=c++17 -O2                            *
+ *             -o ardusketch-score ardusketch-score.cpp  *
+ *********************************************************/
+
+/*
+ Usage:
+   ardusketch-score compile [-c N] [-n NAME] [-o FILE] [--loop] [--drums] song.mid
+   ardusketch-score decode score.h
+   ardusketch-score verify [-c N] [--drums] song.mid ...
+
+ Bytecode (see audio.h):
+   0x9c note   play a MIDI note on channel c
+   0x8c        stop channel c
+   0xE0        restart the score
+   0xF0        stop the score
+   0x00-0x7F   high byte of a 15 bit wait in ms, low byte follows
+
+ Channels are the tune channels, not MIDI channels: 2 with the timers,
+ TUNES_SYNTH_VOICES with the synth.  When more notes sound at once than
+ there are channels, the note that started longest ago is cut short.
+ MIDI channel 10 (drums) is left out unless --drums is given.
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define OP_PLAYNOTE 0x90
+#define OP_STOPNOTE 0x80
+#define OP_RESTART  0xE0
+#define OP_STOP     0xF0
+#define MAX_WAIT    0x7FFF
+#define MAX_CHANNELS 16
+
+/**********************************
+ * Standard MIDI File Reader      *
+ **********************************/
+
+struct MidiNote
+{
+  uint64_t tick;
+  uint32_t seq;     // file order, to keep same tick events stable
+  bool on;
+  uint8_t channel;
+  uint8_t key;
+};
+
+struct Midi
+{
+  std::vector<MidiNote> notes;
+  std::map<uint64_t, uint32_t> tempo;   // tick -> microseconds per quarter
+  uint16_t division = 480;
+};
+
+class MidiReader
+{
+public:
+  explicit MidiReader(const std::vector<uint8_t> &data) : data(data) { }
+
+  Midi read(bool drums)
+  {
+    Midi midi;
+    if (tag() != "MThd") throw std::runtime_error("not a MIDI file");
+    uint32_t length = be(4);
+    uint16_t format = be(2);
+    uint16_t tracks = be(2);
+    midi.division = be(2);
+    pos += length - 6;
+    if (format > 1) throw std::runtime_error("MIDI format 2 is not supported");
+
+    uint32_t seq = 0;
+    for (uint16_t t = 0; t < tracks; t++) {
+      while (tag() != "MTrk") pos += be(4);   // skip unknown chunks
+      uint32_t size = be(4);
+      size_t end = pos + size;
+      if (end > data.size()) throw std::runtime_error("truncated track");
+      uint64_t tick = 0;
+      uint8_t status = 0;
+      while (pos < end) {
+        tick += varLen();
+        uint8_t b = byte();
+        if (b & 0x80) status = b;
+        else if (status) pos--;   // running status
+        else throw std::runtime_error("data byte without a status");
+
+        if (status == 0xFF) {
+          uint8_t type = byte();
+          uint32_t len = varLen();
+          if (type == 0x51 && len == 3) midi.tempo[tick] = be(3);
+          else pos += len;
+          status = 0;
+        }
+        else if (status == 0xF0 || status == 0xF7) {
+          pos += varLen();
+          status = 0;
+        }
+        else {
+          uint8_t kind = status & 0xF0;
+          uint8_t channel = status & 0x0F;
+          uint8_t a = byte();
+          uint8_t v = (kind == 0xC0 || kind == 0xD0) ? 0 : byte();
+          if ((kind == 0x90 || kind == 0x80) && (drums || channel != 9)) {
+            midi.notes.push_back({tick, seq++, kind == 0x90 && v != 0, channel, a});
+          }
+        }
+      }
+      pos = end;
+    }
+
+    // note offs before note ons on the same tick, so repeated notes retrigger
+    std::stable_sort(midi.notes.begin(), midi.notes.end(), [](const MidiNote &x, const MidiNote &y) {
+      if (x.tick != y.tick) return x.tick < y.tick;
+      return !x.on && y.on;
+    });
+    return midi;
+  }
+
+private:
+  const std::vector<uint8_t> &data;
+  size_t pos = 0;
+
+  uint8_t byte()
+  {
+    if (pos >= data.size()) throw std::runtime_error("unexpected end of file");
+    return data[pos++];
+  }
+
+  uint32_t be(int n)
+  {
+    uint32_t v = 0;
+    while (n--) v = (v << 8) | byte();
+    return v;
+  }
+
+  uint32_t varLen()
+  {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+      uint8_t b = byte();
+      v = (v << 7) | (b & 0x7F);
+      if (!(b & 0x80)) return v;
+    }
+    throw std::runtime_error("bad variable length number");
+  }
+
+  std::string tag()
+  {
+    std::string s;
+    for (int i = 0; i < 4; i++) s += (char)byte();
+    return s;
+  }
+};
+
+// Milliseconds from the start of the song, following the tempo map
+class TempoMap
+{
+public:
+  explicit TempoMap(const Midi &midi) : division(midi.division)
+  {
+    uint64_t tick = 0;
+    double us = 0;
+    uint32_t tempo = 500000;
+    for (const auto &change : midi.tempo) {
+      us += (change.first - tick) * usPerTick(tempo);
+      tick = change.first;
+      tempo = change.second;
+      segments.push_back({tick, us, tempo});
+    }
+    if (segments.empty() || segments[0].tick != 0) segments.insert(segments.begin(), {0, 0, 500000});
+  }
+
+  uint32_t ms(uint64_t tick) const
+  {
+    auto it = std::upper_bound(segments.begin(), segments.end(), tick,
+                               [](uint64_t t, const Segment &s) { return t < s.tick; });
+    const Segment &s = *(it - 1);
+    return (uint32_t)((s.us + (tick - s.tick) * usPerTick(s.tempo)) / 1000 + 0.5);
+  }
+
+private:
+  struct Segment
+  {
+    uint64_t tick;
+    double us;
+    uint32_t tempo;
+  };
+  std::vector<Segment> segments;
+  uint16_t division;
+
+  double usPerTick(uint32_t tempo) const
+  {
+    if (division & 0x8000) {   // SMPTE: frames per second and ticks per frame
+      int fps = -(int8_t)(division >> 8);
+      return 1e6 / (fps * (division & 0xFF));
+    }
+    return (double)tempo / division;
+  }
+};
+
+/**********************************
+ * Channel Allocation             *
+ **********************************/
+
+// What one tune channel does at one moment: a note, or NOTE_OFF to stop
+#define NOTE_OFF -1
+
+struct ChannelEvent
+{
+  uint32_t ms;
+  uint8_t chan;
+  int note;
+};
+
+static std::vector<ChannelEvent> allocate(const Midi &midi, int channels)
+{
+  struct Voice
+  {
+    bool busy = false;
+    uint8_t channel = 0, key = 0;
+    uint32_t started = 0;
+  };
+  std::vector<Voice> voices(channels);
+  std::vector<ChannelEvent> out;
+  TempoMap tempo(midi);
+  uint32_t order = 0;
+
+  for (const MidiNote &n : midi.notes) {
+    uint32_t ms = tempo.ms(n.tick);
+    int held = -1;
+    for (int c = 0; c < channels; c++) {
+      if (voices[c].busy && voices[c].channel == n.channel && voices[c].key == n.key) held = c;
+    }
+    if (!n.on) {
+      if (held >= 0) {   // a note cut short by another has nothing to stop
+        voices[held].busy = false;
+        out.push_back({ms, (uint8_t)held, NOTE_OFF});
+      }
+      continue;
+    }
+    int c = held;
+    for (int i = 0; c < 0 && i < channels; i++) {
+      if (!voices[i].busy) c = i;
+    }
+    if (c < 0) {
+      c = 0;
+      for (int i = 1; i < channels; i++) {
+        if (voices[i].started < voices[c].started) c = i;
+      }
+    }
+    voices[c].busy = true;
+    voices[c].channel = n.channel;
+    voices[c].key = n.key;
+    voices[c].started = order++;
+    out.push_back({ms, (uint8_t)c, n.key});
+  }
+  for (int c = 0; c < channels; c++) {
+    if (voices[c].busy) out.push_back({out.empty() ? 0 : out.back().ms, (uint8_t)c, NOTE_OFF});
+  }
+  return out;
+}
+
+/**********************************
+ * Bytecode                       *
+ **********************************/
+
+// One line of output: commands at one moment, then the wait to the next
+struct Group
+{
+  std::vector<uint8_t> commands;
+  uint32_t wait = 0;
+};
+
+static void appendWait(std::vector<Group> &groups, uint32_t ms)
+{
+  if (groups.empty()) groups.push_back(Group());
+  groups.back().wait += ms;
+}
+
+// Every event becomes a command, with a wait wherever the time moves on.
+static std::vector<Group> naiveScore(const std::vector<ChannelEvent> &events)
+{
+  std::vector<Group> groups;
+  uint32_t now = 0;
+  groups.push_back(Group());
+  for (const ChannelEvent &e : events) {
+    if (e.ms > now) {
+      appendWait(groups, e.ms - now);
+      groups.push_back(Group());
+      now = e.ms;
+    }
+    if (e.note == NOTE_OFF) groups.back().commands.push_back(OP_STOPNOTE | e.chan);
+    else {
+      groups.back().commands.push_back(OP_PLAYNOTE | e.chan);
+      groups.back().commands.push_back((uint8_t)e.note);
+    }
+  }
+  return groups;
+}
+
+// Only the last thing each channel does at a moment is kept, and only if
+// it changes what the channel is playing.  A stop followed by a play, or
+// a play of the note already sounding, cost bytecode and a step() for
+// nothing.  Moments left with no commands fold their waits together.
+static std::vector<Group> optimizedScore(const std::vector<ChannelEvent> &events, int channels)
+{
+  std::vector<Group> groups;
+  std::vector<int> sounding(channels, NOTE_OFF);
+  uint32_t now = 0;
+  size_t i = 0;
+  groups.push_back(Group());
+  while (i < events.size()) {
+    uint32_t ms = events[i].ms;
+    std::vector<int> want = sounding;
+    for (; i < events.size() && events[i].ms == ms; i++) want[events[i].chan] = events[i].note;
+
+    std::vector<uint8_t> commands;
+    for (int c = 0; c < channels; c++) {
+      if (want[c] == sounding[c]) continue;
+      if (want[c] == NOTE_OFF) commands.push_back(OP_STOPNOTE | c);
+      else {
+        commands.push_back(OP_PLAYNOTE | c);
+        commands.push_back((uint8_t)want[c]);
+      }
+    }
+    sounding = want;
+    if (commands.empty()) continue;
+    if (ms > now) {
+      appendWait(groups, ms - now);
+      groups.push_back(Group());
+      now = ms;
+    }
+    groups.back().commands.insert(groups.back().commands.end(), commands.begin(), commands.end());
+  }
+  return groups;
+}
+
+static std::vector<uint8_t> encode(const std::vector<Group> &groups, bool loop)
+{
+  std::vector<uint8_t> out;
+  for (const Group &g : groups) {
+    out.insert(out.end(), g.commands.begin(), g.commands.end());
+    for (uint32_t left = g.wait; left; ) {
+      uint32_t w = std::min<uint32_t>(left, MAX_WAIT);
+      out.push_back(w >> 8);
+      out.push_back(w & 0xFF);
+      left -= w;
+    }
+  }
+  out.push_back(loop ? OP_RESTART : OP_STOP);
+  return out;
+}
+
+struct Decoded
+{
+  std::vector<ChannelEvent> events;
+  uint32_t length = 0;      // ms until the end or restart
+  unsigned steps = 1;       // step() calls, one to start and one per wait
+  bool loops = false;
+};
+
+// Walk the bytecode the way step() does.
+static Decoded decode(const std::vector<uint8_t> &score)
+{
+  Decoded d;
+  size_t pos = 0;
+  auto next = [&]() -> uint8_t {
+    if (pos >= score.size()) throw std::runtime_error("score runs off the end");
+    return score[pos++];
+  };
+  while (true) {
+    uint8_t command = next();
+    uint8_t opcode = command & 0xF0;
+    uint8_t chan = command & 0x0F;
+    if (opcode == OP_STOPNOTE) d.events.push_back({d.length, chan, NOTE_OFF});
+    else if (opcode == OP_PLAYNOTE) d.events.push_back({d.length, chan, next() & 0x7F});
+    else if (opcode == OP_RESTART) { d.loops = true; break; }
+    else if (opcode == OP_STOP) break;
+    else if (opcode < 0x80) {
+      uint32_t wait = ((uint32_t)command << 8) | next();
+      d.length += wait ? wait : 1;   // step() waits at least 1ms
+      d.steps++;
+    }
+    else throw std::runtime_error("unknown command " + std::to_string(command));
+  }
+  return d;
+}
+
+// What each channel is playing after every moment something changes
+static std::map<uint32_t, std::vector<int>> states(const std::vector<ChannelEvent> &events, int channels)
+{
+  std::map<uint32_t, std::vector<int>> out;
+  std::vector<int> now(channels, NOTE_OFF);
+  for (const ChannelEvent &e : events) {
+    if (e.chan < channels) now[e.chan] = e.note;
+    out[e.ms] = now;
+  }
+  return out;
+}
+
+static bool sameSound(const std::vector<ChannelEvent> &a, const std::vector<ChannelEvent> &b,
+                      int channels, std::string &where)
+{
+  auto sa = states(a, channels), sb = states(b, channels);
+  std::vector<int> silent(channels, NOTE_OFF), va = silent, vb = silent;
+  auto ia = sa.begin(), ib = sb.begin();
+  while (ia != sa.end() || ib != sb.end()) {
+    uint32_t t = std::min(ia == sa.end() ? UINT32_MAX : ia->first, ib == sb.end() ? UINT32_MAX : ib->first);
+    if (ia != sa.end() && ia->first == t) va = (ia++)->second;
+    if (ib != sb.end() && ib->first == t) vb = (ib++)->second;
+    if (va != vb) {
+      where = "differs at " + std::to_string(t) + "ms";
+      return false;
+    }
+  }
+  return true;
+}
+
+/**********************************
+ * Output                         *
+ **********************************/
+
+static std::string symbolFor(const std::string &path)
+{
+  std::string s = path.substr(path.find_last_of("/\\") + 1);
+  s = s.substr(0, s.find('.'));
+  for (char &c : s) {
+    if (!std::isalnum((unsigned char)c)) c = '_';
+  }
+  if (s.empty() || std::isdigit((unsigned char)s[0])) s = "score_" + s;
+  return s;
+}
+
+static void writeGroup(std::ostream &out, const Group &g, bool &first)
+{
+  std::ostringstream line;
+  for (size_t i = 0; i < g.commands.size(); i++) {
+    uint8_t c = g.commands[i];
+    char hex[8];
+    std::snprintf(hex, sizeof(hex), "0x%02X", c);
+    line << (line.tellp() ? ", " : "") << hex;
+    if ((c & 0xF0) == OP_PLAYNOTE) line << ", " << (int)g.commands[++i];
+  }
+  for (uint32_t left = g.wait; left; ) {
+    uint32_t w = std::min<uint32_t>(left, MAX_WAIT);
+    line << (line.tellp() ? ", " : "") << (w >> 8) << ", " << (w & 0xFF);
+    left -= w;
+  }
+  if (!line.tellp()) return;
+  out << (first ? "" : ",\n") << "  " << line.str();
+  first = false;
+}
+
+static void writeScore(std::ostream &out, const std::string &name, const std::string &source,
+                       const std::vector<Group> &groups, bool loop, int channels, const Decoded &d,
+                       size_t naive_bytes, unsigned naive_steps)
+{
+  size_t bytes = encode(groups, loop).size();
+  out << "// " << source << ": " << channels << " channels, " << d.length << "ms, "
+      << bytes << " bytes (naive " << naive_bytes << "), "
+      << d.steps << " steps (naive " << naive_steps << ")\n";
+  out << "const unsigned char PROGMEM " << name << "[] = {\n";
+  bool first = true;
+  for (const Group &g : groups) writeGroup(out, g, first);
+  out << (first ? "  " : ",\n  ") << (loop ? "0xE0" : "0xF0") << "\n};\n";
+}
+
+// Pull the byte values out of a C array, ignoring comments
+static std::vector<uint8_t> readArray(std::istream &in)
+{
+  std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::string clean;
+  for (size_t i = 0; i < text.size(); i++) {
+    size_t end;
+    if (text.compare(i, 2, "//") == 0) end = text.find('\n', i);
+    else if (text.compare(i, 2, "/*") == 0) end = text.find("*/", i + 2);
+    else {
+      clean += text[i];
+      continue;
+    }
+    if (end == std::string::npos) break;   // comment runs to the end
+    i = text[end] == '*' ? end + 1 : end;
+  }
+  size_t open = clean.find('{'), close = clean.find('}', open);
+  if (open == std::string::npos || close == std::string::npos) throw std::runtime_error("no array found");
+  std::vector<uint8_t> out;
+  std::istringstream body(clean.substr(open + 1, close - open - 1));
+  std::string token;
+  while (std::getline(body, token, ',')) {
+    size_t start = token.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) continue;
+    out.push_back((uint8_t)std::stoul(token.substr(start), nullptr, 0));
+  }
+  return out;
+}
+
+/**********************************
+ * Main                           *
+ **********************************/
+
+struct Options
+{
+  std::string mode;
+  int channels = 2;
+  std::string name;
+  std::string output;
+  bool loop = false;
+  bool drums = false;
+  std::vector<std::string> inputs;
+};
+
+static void usage()
+{
+  std::cerr <<
+    "usage: ardusketch-score compile [-c N] [-n NAME] [-o FILE] [--loop] [--drums] song.mid\n"
+    "       ardusketch-score decode score.h\n"
+    "       ardusketch-score verify [-c N] [--drums] song.mid ...\n";
+  std::exit(2);
+}
+
+static Options parseArgs(int argc, char **argv)
+{
+  Options opt;
+  if (argc < 2) usage();
+  opt.mode = argv[1];
+  if (opt.mode != "compile" && opt.mode != "decode" && opt.mode != "verify") usage();
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-c" && i + 1 < argc) opt.channels = std::atoi(argv[++i]);
+    else if (arg == "-n" && i + 1 < argc) opt.name = argv[++i];
+    else if (arg == "-o" && i + 1 < argc) opt.output = argv[++i];
+    else if (arg == "--loop") opt.loop = true;
+    else if (arg == "--drums") opt.drums = true;
+    else if (!arg.empty() && arg[0] == '-') usage();
+    else opt.inputs.push_back(arg);
+  }
+  if (opt.inputs.empty() || opt.channels < 1 || opt.channels > MAX_CHANNELS) usage();
+  if (opt.mode == "compile" && opt.inputs.size() != 1) usage();
+  return opt;
+}
+
+static Midi loadMidi(const std::string &path, bool drums)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in) throw std::runtime_error("cannot open");
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  return MidiReader(data).read(drums);
+}
+
+static void compile(const Options &opt)
+{
+  const std::string &path = opt.inputs[0];
+  std::vector<ChannelEvent> events = allocate(loadMidi(path, opt.drums), opt.channels);
+  std::vector<Group> naive = naiveScore(events);
+  std::vector<Group> groups = optimizedScore(events, opt.channels);
+  std::vector<uint8_t> naive_bytes = encode(naive, opt.loop);
+
+  std::ofstream file;
+  if (!opt.output.empty()) {
+    file.open(opt.output);
+    if (!file) throw std::runtime_error("cannot write " + opt.output);
+  }
+  std::ostream &out = opt.output.empty() ? std::cout : file;
+  writeScore(out, opt.name.empty() ? symbolFor(path) : opt.name, path, groups, opt.loop,
+             opt.channels, decode(encode(groups, opt.loop)), naive_bytes.size(), decode(naive_bytes).steps);
+}
+
+static void printTimeline(const std::string &path)
+{
+  std::ifstream in(path);
+  if (!in) throw std::runtime_error("cannot open");
+  Decoded d = decode(readArray(in));
+  for (const ChannelEvent &e : d.events) {
+    if (e.note == NOTE_OFF) std::printf("%8ums  chan %u  stop\n", e.ms, e.chan);
+    else std::printf("%8ums  chan %u  note %d\n", e.ms, e.chan, e.note);
+  }
+  std::printf("%8ums  %s, %u steps\n", d.length, d.loops ? "restart" : "end", d.steps);
+}
+
+// Both conversions must decode to the same sound as the allocation, and
+// the compiled score must be no bigger and step no more than the naive one.
+static bool verify(const Options &opt, const std::string &path)
+{
+  std::vector<ChannelEvent> events = allocate(loadMidi(path, opt.drums), opt.channels);
+  std::vector<uint8_t> naive = encode(naiveScore(events), false);
+  std::vector<uint8_t> compiled = encode(optimizedScore(events, opt.channels), false);
+  Decoded dn = decode(naive), dc = decode(compiled);
+  std::string where;
+  bool ok = true;
+  if (!sameSound(events, dn.events, opt.channels, where)) {
+    std::cerr << path << ": naive score " << where << "\n";
+    ok = false;
+  }
+  if (!sameSound(events, dc.events, opt.channels, where)) {
+    std::cerr << path << ": compiled score " << where << "\n";
+    ok = false;
+  }
+  if (compiled.size() > naive.size() || dc.steps > dn.steps) {
+    std::cerr << path << ": compiled score is bigger than the naive one\n";
+    ok = false;
+  }
+  std::printf("%s: %s, %zu bytes (naive %zu), %u steps (naive %u), %ums\n", path.c_str(),
+              ok ? "ok" : "FAILED", compiled.size(), naive.size(), dc.steps, dn.steps, dc.length);
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  Options opt = parseArgs(argc, argv);
+  int failures = 0;
+  for (const std::string &path : opt.inputs) {
+    try {
+      if (opt.mode == "compile") compile(opt);
+      else if (opt.mode == "decode") printTimeline(path);
+      else if (!verify(opt, path)) failures++;
+    }
+    catch (const std::exception &e) {
+      std::cerr << "ardusketch-score: " << path << ": " << e.what() << "\n";
+      failures++;
+    }
+  }
+  return failures ? 1 : 0;
+}
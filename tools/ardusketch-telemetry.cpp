@@ -0,0 +1,315 @@
+/*********************************************************
+ *                                                       *
+ *                 ARDUSKETCH-TELEMETRY                  *
+ *                                                       *
+ *   Host side decoder for the binary telemetry frames   *
+ *   ArduSketch sends over Serial when it is built with  *
+ *   PROFILING (see telemetry.h).                        *
+ *                                                       *
+ *   Reads the serial port, or a capture of it, and      *
+ *   prints a table for every frame.  Anything between   *
+ *   frames, such as writeCode() output, is skipped.     *
+ *                                                       *
+ *  Build: g++ -std=c++17 -O2                            *
+ *             -o ardusketch-telemetry ardusketch-telemetry.cpp
+ *********************************************************/
+
+/*
+ Usage:
+   ardusketch-telemetry [--once] /dev/ttyACM0
+   ardusketch-telemetry [--once] capture.bin
+   ardusketch-telemetry [--once] -              (standard input)
+
+ Frame (little endian):
+   0xA5 type length payload[length] checksum
+   checksum is the low byte of type + length + every payload byte.
+
+ On a terminal the latest table of each frame type is redrawn in place,
+ otherwise every frame is printed in turn.  --once stops after the first frame.
+*/
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define TELEMETRY_SYNC    0xA5
+#define TELEMETRY_PROFILE 0x01
+#define TELEMETRY_BUS     0x02
+#define TELEMETRY_RAM     0x03
+#define TELEMETRY_WAKE    0x04
+#define TELEMETRY_TASKS   0x05
+#define SPI_PUSH_US       500
+
+static const char *phase_names[] = { "input", "logic", "draw", "push", "audio" };
+static const char *task_names[] = { "input", "render", "autosave", "telemetry" };
+
+static bool live = false;
+static std::string table;                   // the frame being printed
+static std::map<uint8_t, std::string> latest;  // by type, when live
+
+static void usage()
+{
+  fprintf(stderr, "usage: ardusketch-telemetry [--once] PORT|FILE|-\n");
+  exit(2);
+}
+
+static uint16_t u16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t u32(const uint8_t *p)
+{
+  return u16(p) | ((uint32_t)u16(p + 2) << 16);
+}
+
+static void say(const char *format, ...)
+{
+  char line[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  table += line;
+}
+
+/**********************************
+ * Frame Printers                 *
+ **********************************/
+
+static void printProfile(const std::vector<uint8_t> &payload)
+{
+  size_t phases = payload.size() / 8;
+
+  say("%-8s %8s %8s %8s %8s\n", "phase", "runs", "min us", "avg us", "max us");
+  for (size_t i = 0; i < phases; i++) {
+    const uint8_t *p = &payload[i * 8];
+    std::string name = i < sizeof(phase_names) / sizeof(*phase_names) ?
+      phase_names[i] : "#" + std::to_string(i);
+    if (!u16(p)) {
+      say("%-8s %8u %8s %8s %8s\n", name.c_str(), 0, "-", "-", "-");
+      continue;
+    }
+    say("%-8s %8u %8u %8u %8u\n", name.c_str(), u16(p), u16(p + 2), u16(p + 4), u16(p + 6));
+  }
+}
+
+// counters since the last bus frame, a second apart
+static void printBus(const std::vector<uint8_t> &payload)
+{
+  if (payload.size() < 10) {
+    say("short bus frame\n");
+    return;
+  }
+  uint32_t bytes = u32(&payload[0]);
+  uint32_t commands = u32(&payload[4]);
+  uint16_t pushes = u16(&payload[8]);
+  size_t buckets = (payload.size() - 10) / 2;
+
+  say("display bus: %u data bytes, %u commands, %u pushes", bytes, commands, pushes);
+  if (pushes)
+    say(", %u bytes per push", bytes / pushes);
+  say("\n%-12s %8s\n", "push us", "pushes");
+  for (size_t i = 0; i < buckets; i++) {
+    unsigned from = i * SPI_PUSH_US;
+    std::string range = i + 1 < buckets ?
+      std::to_string(from) + "-" + std::to_string(from + SPI_PUSH_US) :
+      std::to_string(from) + "+";
+    say("%-12s %8u\n", range.c_str(), u16(&payload[10 + i * 2]));
+  }
+}
+
+static void printRam(const std::vector<uint8_t> &payload)
+{
+  if (payload.size() < 6) {
+    say("short ram frame\n");
+    return;
+  }
+  say("ram: %u bytes free, %u least free, %u most stack\n",
+      u16(&payload[0]), u16(&payload[2]), u16(&payload[4]));
+}
+
+static void printWake(const std::vector<uint8_t> &payload)
+{
+  if (payload.size() < 4) {
+    say("short wake frame\n");
+    return;
+  }
+  if (!u16(&payload[0])) {
+    say("wake: not slept yet\n");
+    return;
+  }
+  say("wake: %u wakes, %u us from the last one to the end of its first frame\n",
+      u16(&payload[0]), u16(&payload[2]));
+}
+
+// counters since the last tasks frame, a second apart
+static void printTasks(const std::vector<uint8_t> &payload)
+{
+  if (payload.size() < 2) {
+    say("short tasks frame\n");
+    return;
+  }
+  size_t tasks = (payload.size() - 2) / 7;
+
+  say("scheduler: slept %u times\n", u16(&payload[0]));
+  say("%-10s %8s %8s %10s %8s\n", "task", "runs", "skips", "jitter us", "load %");
+  for (size_t i = 0; i < tasks; i++) {
+    const uint8_t *p = &payload[2 + i * 7];
+    std::string name = i < sizeof(task_names) / sizeof(*task_names) ?
+      task_names[i] : "#" + std::to_string(i);
+    say("%-10s %8u %8u %10u %8u\n", name.c_str(), u16(p), u16(p + 2), u16(p + 4), p[6]);
+  }
+}
+
+static void printFrame(uint8_t type, const std::vector<uint8_t> &payload)
+{
+  table.clear();
+  switch (type) {
+    case TELEMETRY_PROFILE:
+      printProfile(payload);
+      break;
+    case TELEMETRY_BUS:
+      printBus(payload);
+      break;
+    case TELEMETRY_RAM:
+      printRam(payload);
+      break;
+    case TELEMETRY_WAKE:
+      printWake(payload);
+      break;
+    case TELEMETRY_TASKS:
+      printTasks(payload);
+      break;
+    default:
+      say("frame type 0x%02X, %zu bytes\n", type, payload.size());
+      break;
+  }
+  table += "\n";
+
+  if (live) {
+    latest[type] = table;
+    printf("\033[H\033[J");
+    for (const auto &t : latest)
+      fputs(t.second.c_str(), stdout);
+  }
+  else {
+    fputs(table.c_str(), stdout);
+  }
+  fflush(stdout);
+}
+
+/**********************************
+ * Frame Parser                   *
+ **********************************/
+
+class FrameParser
+{
+public:
+  // returns true when c completes a frame with a good checksum
+  bool feed(uint8_t c)
+  {
+    switch (state) {
+      case WAIT_SYNC:
+        if (c == TELEMETRY_SYNC)
+          state = TYPE;
+        return false;
+      case TYPE:
+        type = c;
+        state = LENGTH;
+        return false;
+      case LENGTH:
+        length = c;
+        payload.clear();
+        state = length ? PAYLOAD : CHECKSUM;
+        return false;
+      case PAYLOAD:
+        payload.push_back(c);
+        if (payload.size() == length)
+          state = CHECKSUM;
+        return false;
+      case CHECKSUM: {
+        state = WAIT_SYNC;
+        uint8_t sum = type + length;
+        for (uint8_t b : payload)
+          sum += b;
+        if (sum != c) {
+          bad++;
+          return false;
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  uint8_t type = 0;
+  std::vector<uint8_t> payload;
+  unsigned bad = 0;   // frames dropped for a bad checksum
+
+private:
+  enum { WAIT_SYNC, TYPE, LENGTH, PAYLOAD, CHECKSUM } state = WAIT_SYNC;
+  uint8_t length = 0;
+};
+
+// raw mode, so no byte of a frame is taken for a line ending or a signal
+static void rawPort(int fd)
+{
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0)
+    return;
+  cfmakeraw(&tio);
+  cfsetspeed(&tio, B115200);   // USB CDC ignores it
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+  tcsetattr(fd, TCSANOW, &tio);
+}
+
+int main(int argc, char **argv)
+{
+  bool once = false;
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--once") once = true;
+    else if (arg != "-" && arg[0] == '-') usage();
+    else if (path) usage();
+    else path = argv[i];
+  }
+  if (!path) usage();
+
+  int fd = strcmp(path, "-") ? open(path, O_RDONLY | O_NOCTTY) : STDIN_FILENO;
+  if (fd < 0) {
+    perror(path);
+    return 1;
+  }
+  if (isatty(fd))
+    rawPort(fd);
+  live = isatty(STDOUT_FILENO) && !once;
+
+  FrameParser parser;
+  uint8_t buf[256];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t i = 0; i < n; i++) {
+      if (!parser.feed(buf[i]))
+        continue;
+      printFrame(parser.type, parser.payload);
+      if (once)
+        return 0;
+    }
+  }
+  if (parser.bad)
+    fprintf(stderr, "%u frames with a bad checksum\n", parser.bad);
+  return 0;
+}